@@ -0,0 +1,34 @@
+#!/bin/bash -eu
+set -o pipefail
+
+# Benchmark the Java version: single threaded htsjdk writer vs parallel BGZF compression
+# Build the jar first ('script/make.sh')
+#
+# Usage: bench_java_threads.sh in.bam [level]
+
+SCRIPT_DIR=$(cd $(dirname "$0") ; pwd -P)
+PROJECT_HOME=$(dirname $SCRIPT_DIR)
+JAR=$(ls "$PROJECT_HOME"/target/umi_rx-*-jar-with-dependencies.jar | head -n 1)
+
+IN="$1"
+LEVEL=${2:-5}
+TMP_DIR=$(mktemp -d)
+trap "rm -rf '$TMP_DIR'" EXIT
+
+# Run UmiRx, show elapsed time and output size
+run() {
+	name="$1"
+	shift
+	out="$TMP_DIR/$name.bam"
+	start=$(date +%s.%N)
+	java -jar "$JAR" --rx --mc --mq --comp $LEVEL "$@" -i "$IN" -o "$out" 2> /dev/null
+	end=$(date +%s.%N)
+	size=$(stat -c %s "$out")
+	echo -e "$name\t$(echo "$end - $start" | bc)\t$size"
+}
+
+echo -e "mode\tseconds\tbytes"
+run "htsjdk"
+for threads in 1 2 4 8; do
+	run "threads_$threads" --threads $threads
+done
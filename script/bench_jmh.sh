@@ -0,0 +1,17 @@
+#!/bin/bash -eu
+set -o pipefail
+
+# Build and run the JMH benchmarks of the Java version: ops/s and allocation rate per method
+# Results are also saved to 'jmh_results.json'
+#
+# Usage: bench_jmh.sh [benchmark_regex] [extra JMH options]
+
+SCRIPT_DIR=$(cd $(dirname "$0") ; pwd -P)
+PROJECT_HOME=$(dirname $SCRIPT_DIR)
+cd "$PROJECT_HOME"
+
+BENCHMARKS=${1:-umi.rx}
+shift || true
+
+mvn -q -P jmh clean package -DskipTests
+java -jar target/benchmarks.jar "$BENCHMARKS" -prof gc -rf json -rff jmh_results.json "$@"
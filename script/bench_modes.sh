@@ -0,0 +1,66 @@
+#!/bin/bash -eu
+set -o pipefail
+
+# Benchmark each specialized tagging loop, one run per specialization:
+#   - Record loops ('tag_batch_table' in 'src/tagger.c'): tag removal x quality binning, RX only
+#   - Mate tag loops ('mate_group_table' in 'src/mate.c'): each tag set, with the plain RX record loop
+# Output is uncompressed, so the time is dominated by decoding and tagging.
+# Mate tag modes need an input grouped by read name.
+#
+# Usage: bench_modes.sh in.bam [threads] [repeats]
+
+SCRIPT_DIR=$(cd $(dirname "$0") ; pwd -P)
+PROJECT_HOME=$(dirname $SCRIPT_DIR)
+UMI_RX="$PROJECT_HOME/bin/umi_rx"
+
+IN="$1"
+THREADS=${2:-0}
+REPEATS=${3:-3}
+TMP_DIR=$(mktemp -d)
+trap "rm -rf '$TMP_DIR'" EXIT
+
+# Run umi_rx, show the best elapsed time over all repeats
+run() {
+	name="$1"
+	shift
+	best=""
+	for i in $(seq $REPEATS); do
+		start=$(date +%s.%N)
+		"$UMI_RX" -@ "$THREADS" -l 0 "$@" "$IN" "$TMP_DIR/out.bam" 2> /dev/null
+		end=$(date +%s.%N)
+		t=$(echo "$end - $start" | bc)
+		if [ -z "$best" ] || [ $(echo "$t < $best" | bc) -eq 1 ]; then best=$t; fi
+	done
+	echo -e "$name\t$best"
+}
+
+echo -e "mode\tseconds"
+
+# Record loops: [filter_tags][bin_quals]
+for filter in none remove keep; do
+	case $filter in
+		none) filter_opts=() ;;
+		remove) filter_opts=(--remove-tags 'XA,SA,OQ') ;;
+		keep) filter_opts=(--keep-tags 'RG,NM,MD') ;;
+	esac
+	run "rx_${filter}_tags" ${filter_opts[@]+"${filter_opts[@]}"}
+	run "rx_${filter}_tags_qual_bin" ${filter_opts[@]+"${filter_opts[@]}"} --qual-bin illumina
+done
+
+# Mate tag loops: [calc_mc][calc_mq][calc_ms][fixmate], except no tags (same as 'rx_none_tags')
+for mc in 0 1; do
+	for mq in 0 1; do
+		for ms in 0 1; do
+			for fix in 0 1; do
+				[ $mc$mq$ms$fix = 0000 ] && continue
+				name="rx"
+				opts=()
+				[ $mc = 1 ] && name="${name}_mc" && opts+=(--mc)
+				[ $mq = 1 ] && name="${name}_mq" && opts+=(--mq)
+				[ $ms = 1 ] && name="${name}_ms" && opts+=(--ms)
+				[ $fix = 1 ] && name="${name}_fixmate" && opts+=(--fixmate)
+				run "$name" "${opts[@]}"
+			done
+		done
+	done
+done
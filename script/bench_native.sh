@@ -0,0 +1,43 @@
+#!/bin/bash -eu
+set -o pipefail
+
+# Benchmark the Java version: JVM (fat JAR) vs native executable
+#   - Startup: run on an empty BAM (header only), repeated 'REPEAT' times
+#   - Throughput: run on the input BAM
+# Build both first ('script/make_native.sh')
+#
+# Usage: bench_native.sh in.bam [repeat]
+
+SCRIPT_DIR=$(cd $(dirname "$0") ; pwd -P)
+PROJECT_HOME=$(dirname $SCRIPT_DIR)
+JAR=$(ls "$PROJECT_HOME"/target/umi_rx-*-jar-with-dependencies.jar | head -n 1)
+NATIVE="$PROJECT_HOME/target/umi_rx"
+
+IN="$1"
+REPEAT=${2:-10}
+TMP_DIR=$(mktemp -d)
+trap "rm -rf '$TMP_DIR'" EXIT
+
+# Empty BAM (same header as the input)
+EMPTY="$TMP_DIR/empty.bam"
+samtools view -H -b -o "$EMPTY" "$IN"
+
+# Run a command 'n' times on a BAM file, show elapsed time and time per run
+run() {
+	name="$1"
+	in="$2"
+	n="$3"
+	shift 3
+	start=$(date +%s.%N)
+	for i in $(seq $n); do
+		"$@" --rx --mc --mq -i "$in" -o "$TMP_DIR/out.bam" 2> /dev/null
+	done
+	end=$(date +%s.%N)
+	echo -e "$name\t$n\t$(echo "$end - $start" | bc)\t$(echo "($end - $start) / $n" | bc -l)"
+}
+
+echo -e "test\truns\tseconds\tseconds_per_run"
+run "startup_jvm" "$EMPTY" $REPEAT java -jar "$JAR"
+run "startup_native" "$EMPTY" $REPEAT "$NATIVE"
+run "throughput_jvm" "$IN" 1 java -jar "$JAR"
+run "throughput_native" "$IN" 1 "$NATIVE"
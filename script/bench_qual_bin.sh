@@ -0,0 +1,34 @@
+#!/bin/bash -eu
+set -o pipefail
+
+# Benchmark quality score binning: output size and run time, with and without binning
+#
+# Usage: bench_qual_bin.sh in.bam [threads]
+
+SCRIPT_DIR=$(cd $(dirname "$0") ; pwd -P)
+PROJECT_HOME=$(dirname $SCRIPT_DIR)
+UMI_RX="$PROJECT_HOME/bin/umi_rx"
+
+IN="$1"
+THREADS=${2:-0}
+TMP_DIR=$(mktemp -d)
+trap "rm -rf '$TMP_DIR'" EXIT
+
+# Run umi_rx, show elapsed time and output size
+run() {
+	name="$1"
+	shift
+	out="$TMP_DIR/$name.bam"
+	start=$(date +%s.%N)
+	"$UMI_RX" -@ "$THREADS" "$@" "$IN" "$out" 2> /dev/null
+	end=$(date +%s.%N)
+	size=$(stat -c %s "$out")
+	echo -e "$name\t$(echo "$end - $start" | bc)\t$size"
+}
+
+echo -e "mode\tseconds\tbytes"
+for level in 1 6; do
+	run "level${level}_raw" -l $level
+	run "level${level}_illumina" -l $level --qual-bin illumina
+	run "level${level}_4bins" -l $level --qual-bin '0:0,2:12,15:23,30:37'
+done
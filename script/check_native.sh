@@ -0,0 +1,50 @@
+#!/bin/bash -eu
+set -o pipefail
+
+# Check that the native backend (JNI, C engine) and htsjdk give the same records,
+# also on the input with RX tags already added to some records
+# Build first: 'script/make.sh' (JAR) and 'script/make_c.sh' with JAVA_HOME set
+#
+# Usage: check_native.sh in.bam [umi_rx options, default: --rx --mc --mq]
+
+SCRIPT_DIR=$(cd $(dirname "$0") ; pwd -P)
+PROJECT_HOME=$(dirname $SCRIPT_DIR)
+JAR=$(ls "$PROJECT_HOME"/target/umi_rx-*-jar-with-dependencies.jar | head -n 1)
+JNI="$PROJECT_HOME/bin/libumirx_jni.so"
+
+IN="$1"
+shift
+OPTS=${@:---rx --mc --mq}
+TMP_DIR=$(mktemp -d)
+trap "rm -rf '$TMP_DIR'" EXIT
+
+if [ ! -f "$JNI" ]; then
+	echo "Native library '$JNI' not found"
+	exit 1
+fi
+
+# Run both backends on a BAM file and compare the records
+compare() {
+	local in="$1" name="$2"
+	java -Dumirx.jni="$JNI" -jar "$JAR" $OPTS -i "$in" -o "$TMP_DIR/native.bam" 2> "$TMP_DIR/native.log"
+	java -jar "$JAR" $OPTS --htsjdk -i "$in" -o "$TMP_DIR/htsjdk.bam" 2> "$TMP_DIR/htsjdk.log"
+
+	# Records only: headers differ ('@PG' lines)
+	samtools view "$TMP_DIR/native.bam" > "$TMP_DIR/native.sam"
+	samtools view "$TMP_DIR/htsjdk.bam" > "$TMP_DIR/htsjdk.sam"
+	if cmp -s "$TMP_DIR/native.sam" "$TMP_DIR/htsjdk.sam"; then
+		echo "OK: $name, $(wc -l < "$TMP_DIR/native.sam") records, same output"
+	else
+		echo "DIFFERENT: $name, first differences (< native, > htsjdk)"
+		diff "$TMP_DIR/native.sam" "$TMP_DIR/htsjdk.sam" | head -n 20 || true
+		exit 1
+	fi
+}
+
+compare "$IN" "input"
+
+# Input with RX tags already in every other record: they must be kept, not duplicated
+samtools view -h "$IN" \
+	| awk '/^@/ { print; next } NR % 2 && !/\tRX:Z:/ { $0 = $0 "\tRX:Z:PRETAGGED" } { print }' \
+	| samtools view -b -o "$TMP_DIR/rx.bam" -
+compare "$TMP_DIR/rx.bam" "input with RX tags"
@@ -0,0 +1,57 @@
+#!/bin/bash -eu
+set -o pipefail
+
+# Check that a run killed after a checkpoint and resumed gives the same records as an
+# uninterrupted run, and that a checkpoint is not resumed with different options.
+# The input must be large enough for the run to last a few seconds
+# Build first: 'script/make_c.sh'
+#
+# Usage: check_resume.sh in.bam [umi_rx options, default: --mc --mq]
+
+SCRIPT_DIR=$(cd $(dirname "$0") ; pwd -P)
+UMI_RX="$SCRIPT_DIR/umi_rx.sh"
+
+IN="$1"
+shift
+OPTS=${@:---mc --mq}
+TMP_DIR=$(mktemp -d)
+trap "rm -rf '$TMP_DIR'" EXIT
+CKPT="$TMP_DIR/out.bam.ckpt"
+
+"$UMI_RX" $OPTS "$IN" "$TMP_DIR/full.bam" 2> "$TMP_DIR/full.log"
+
+# Kill the run (no cleanup, as a preemption) after its first checkpoint
+"$UMI_RX" $OPTS --checkpoint "$CKPT" --checkpoint-every 1 "$IN" "$TMP_DIR/out.bam" 2> "$TMP_DIR/killed.log" &
+pid=$!
+while [ ! -f "$CKPT" ] && kill -0 $pid 2> /dev/null; do sleep 0.1; done
+kill -9 $pid 2> /dev/null || true
+wait $pid 2> /dev/null || true
+if [ ! -f "$CKPT" ]; then
+	echo "Run finished before its first checkpoint, use a larger input"
+	exit 1
+fi
+
+# Different options: refused, nothing changed
+if "$UMI_RX" $OPTS --max-group 12345 --checkpoint "$CKPT" --resume "$IN" "$TMP_DIR/out.bam" 2> "$TMP_DIR/other.log"; then
+	echo "FAILED: checkpoint resumed with different options"
+	exit 1
+fi
+if ! grep -q "saved by a different run" "$TMP_DIR/other.log"; then
+	echo "FAILED: no error for different options"
+	cat "$TMP_DIR/other.log"
+	exit 1
+fi
+
+"$UMI_RX" $OPTS --checkpoint "$CKPT" --resume "$IN" "$TMP_DIR/out.bam" 2> "$TMP_DIR/resumed.log"
+grep "Resuming" "$TMP_DIR/resumed.log"
+
+# Records only: headers differ ('@PG' lines)
+samtools view "$TMP_DIR/full.bam" > "$TMP_DIR/full.sam"
+samtools view "$TMP_DIR/out.bam" > "$TMP_DIR/out.sam"
+if cmp -s "$TMP_DIR/full.sam" "$TMP_DIR/out.sam"; then
+	echo "OK: $(wc -l < "$TMP_DIR/out.sam") records, same output"
+else
+	echo "DIFFERENT: first differences (< uninterrupted, > resumed)"
+	diff "$TMP_DIR/full.sam" "$TMP_DIR/out.sam" | head -n 20 || true
+	exit 1
+fi
@@ -0,0 +1,67 @@
+#!/bin/bash -eu
+set -o pipefail
+
+# Check that malformed aux tags are reported (not read past the end of the record)
+# and that records kept by the error policy are not changed.
+# The last record has a truncated trailing tag ('XB:i' with only two bytes)
+# Build first: 'script/make_c.sh'
+#
+# Usage: check_tags.sh
+
+SCRIPT_DIR=$(cd $(dirname "$0") ; pwd -P)
+UMI_RX="$SCRIPT_DIR/umi_rx.sh"
+TMP_DIR=$(mktemp -d)
+trap "rm -rf '$TMP_DIR'" EXIT
+
+# Unaligned BAM, written directly: SAM can't hold a truncated tag
+python3 - "$TMP_DIR/in.bam" <<'EOF'
+import struct, sys, zlib
+
+def record(name, aux):
+    name = name.encode() + b'\0'
+    seq, qual = bytes([0x12, 0x48]), bytes([30] * 4)  # ACGT
+    core = struct.pack('<iiBBHHHiiii', -1, -1, len(name), 0, 4680, 0, 4, 4, -1, -1, 0)
+    data = core + name + seq + qual + aux
+    return struct.pack('<i', len(data)) + data
+
+def bgzf_block(data):
+    c = zlib.compressobj(6, zlib.DEFLATED, -15)
+    cdata = c.compress(data) + c.flush()
+    head = struct.pack('<BBBBIBBHBBHH', 31, 139, 8, 4, 0, 0, 255, 6, 66, 67, 2, len(cdata) + 25)
+    return head + cdata + struct.pack('<II', zlib.crc32(data), len(data))
+
+text = b'@HD\tVN:1.6\tSO:unsorted\n'
+data = b'BAM\1' + struct.pack('<i', len(text)) + text + struct.pack('<i', 0)
+data += record('r1:AAAA', b'XAZhello\0' + b'XBi' + struct.pack('<i', 7))
+data += record('r2:CCCC', b'XAZhello\0' + b'XBi' + struct.pack('<i', 7))
+data += record('r3:GGGG', b'XAZhello\0' + b'XBi' + b'\1\0')
+with open(sys.argv[1], 'wb') as f:
+    f.write(bgzf_block(data) + bgzf_block(b''))
+EOF
+
+fail() {
+	echo "FAILED: $*"
+	cat "$TMP_DIR/log"
+	exit 1
+}
+
+for opt in "--remove-tags XB" "--keep-tags XA"; do
+	# Default policy: abort with an error naming the record
+	if "$UMI_RX" $opt "$TMP_DIR/in.bam" "$TMP_DIR/out.bam" 2> "$TMP_DIR/log"; then fail "$opt: truncated tag accepted"; fi
+	grep -q "Malformed tags.*read_name='r3:GGGG'" "$TMP_DIR/log" || fail "$opt: no error for the truncated tag"
+
+	# Skip: the two good records are written
+	"$UMI_RX" $opt --on-error skip "$TMP_DIR/in.bam" "$TMP_DIR/out.bam" 2> "$TMP_DIR/log" || fail "$opt --on-error skip"
+	n=$(samtools view -c "$TMP_DIR/out.bam")
+	[ "$n" == 2 ] || fail "$opt --on-error skip: $n records, expected 2"
+
+	# Pass: the malformed record is written unchanged (no tags removed, no RX)
+	"$UMI_RX" $opt --on-error pass "$TMP_DIR/in.bam" "$TMP_DIR/out.bam" 2> "$TMP_DIR/log" || fail "$opt --on-error pass"
+	python3 - "$TMP_DIR/in.bam" "$TMP_DIR/out.bam" <<'PY' || fail "$opt --on-error pass: malformed record changed"
+import gzip, sys
+data = gzip.open(sys.argv[1]).read()
+bad = data[data.index(b'r3:GGGG') - 36:]	# Last record, from its 'block_size'
+assert gzip.open(sys.argv[2]).read().endswith(bad)
+PY
+	echo "OK: $opt"
+done
@@ -0,0 +1,78 @@
+#!/bin/bash -eu
+set -o pipefail
+
+# Build the C version of umi_rx into 'bin/umi_rx', example plugins into 'bin/plugins',
+# the embeddable library into 'bin/libumirx.{a,so}' (header: 'src/umirx.h')
+# and the JNI backend of the Java version into 'bin/libumirx_jni.so' (if JAVA_HOME is set)
+# htslib is expected in 'htslib/{include,lib}', set HTSLIB to override
+
+SCRIPT_DIR=$(cd $(dirname "$0") ; pwd -P)
+PROJECT_HOME=$(dirname $SCRIPT_DIR)
+cd "$PROJECT_HOME"
+
+HTSLIB=${HTSLIB:-$PROJECT_HOME/htslib}
+CC=${CC:-gcc}
+CFLAGS=${CFLAGS:--O3 -Wall}
+
+# USDT probes ('src/probes.h'), needs 'sys/sdt.h'
+if [ "${USDT:-0}" = "1" ]; then
+	CFLAGS="$CFLAGS -DUMI_RX_USDT"
+fi
+
+# Allocator for 'bin/umi_rx' (also used by htslib): ALLOCATOR=mimalloc or ALLOCATOR=jemalloc
+ALLOCATOR=${ALLOCATOR:-}
+ALLOC_LIBS=""
+case "$ALLOCATOR" in
+	"") ;;
+	mimalloc|jemalloc) ALLOC_LIBS="-l$ALLOCATOR" ;;
+	*) echo "Unknown ALLOCATOR '$ALLOCATOR' (use 'mimalloc' or 'jemalloc')" ; exit 1 ;;
+esac
+
+mkdir -p bin bin/plugins
+$CC $CFLAGS ${ALLOCATOR:+-DUMI_RX_ALLOCATOR=\"$ALLOCATOR\"} -pthread -rdynamic \
+	-I src -I "$HTSLIB/include" \
+	-o bin/umi_rx src/*.c \
+	$ALLOC_LIBS -L "$HTSLIB/lib" -lhts -lz -lpthread -ldl
+
+# Plugins use htslib symbols from the umi_rx process
+for p in src/plugins/*.c; do
+	$CC $CFLAGS -shared -fPIC \
+		-I src -I "$HTSLIB/include" \
+		-o bin/plugins/$(basename $p .c).so $p
+done
+
+# Library: static and shared, only 'umirx_*' symbols are global in both.
+# The static archive is one partially linked object with hidden symbols made local,
+# so internal functions (e.g. 'tagger_init') can't collide with the embedding program
+LIB_SRC="src/umirx.c src/tagger.c src/mate.c src/tags.c src/qual_bin.c src/filter.c"
+OBJ_DIR=bin/obj
+mkdir -p $OBJ_DIR
+rm -f $OBJ_DIR/*.o
+for f in $LIB_SRC; do
+	$CC $CFLAGS -fPIC -fvisibility=hidden \
+		-I src -I "$HTSLIB/include" \
+		-c -o $OBJ_DIR/$(basename $f .c).o $f
+done
+rm -f bin/libumirx.a $OBJ_DIR/libumirx.o
+${LD:-ld} -r -o $OBJ_DIR/libumirx.o $OBJ_DIR/*.o
+${OBJCOPY:-objcopy} --localize-hidden $OBJ_DIR/libumirx.o
+ar rcs bin/libumirx.a $OBJ_DIR/libumirx.o
+if nm -g --defined-only bin/libumirx.a | grep -E ' [A-Z] ' | grep -v ' umirx_' ; then
+	echo "Error: 'bin/libumirx.a' exports symbols without 'umirx_' prefix (above)"
+	exit 1
+fi
+$CC -shared -Wl,-soname,libumirx.so.1 \
+	-o bin/libumirx.so.1 $OBJ_DIR/libumirx.o \
+	-L "$HTSLIB/lib" -lhts -lz -lpthread
+ln -sf libumirx.so.1 bin/libumirx.so
+
+# JNI backend for the Java version ('umi.rx.NativeUmiRx'), only if a JDK is found
+JNI_SRC="src/jni/umi_rx_jni.c src/engine.c src/checkpoint.c src/stats.c src/trace.c src/mem.c src/plugin.c src/queue.c src/tagger.c src/mate.c src/tags.c src/qual_bin.c src/filter.c"
+if [ -n "${JAVA_HOME:-}" ] && [ -f "$JAVA_HOME/include/jni.h" ]; then
+	$CC $CFLAGS -shared -fPIC -pthread \
+		-I src -I "$HTSLIB/include" -I "$JAVA_HOME/include" -I "$JAVA_HOME/include/linux" \
+		-o bin/libumirx_jni.so $JNI_SRC \
+		-L "$HTSLIB/lib" -Wl,-rpath,"$HTSLIB/lib" -lhts -lz -lpthread -ldl
+else
+	echo "JAVA_HOME not set (or no 'jni.h'), skipping 'bin/libumirx_jni.so'"
+fi
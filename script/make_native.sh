@@ -0,0 +1,7 @@
+#!/bin/bash -eu
+set -o pipefail
+
+# Build the JAR and a native executable of UmiRx (GraalVM 'native-image' must be in the PATH)
+# Creates 'target/umi_rx-0.1-jar-with-dependencies.jar' and 'target/umi_rx'
+
+mvn -P native clean package assembly:single -DskipTests
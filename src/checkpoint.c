@@ -0,0 +1,153 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC "umi_rx_checkpoint"
+#define CHECKPOINT_VERSION 3    // Version 2: error counters, version 3: run identity
+#define CHECKPOINT_NFIELDS 12
+#define CHECKPOINT_NRUN_FIELDS 5
+
+typedef struct checkpoint_field_t {
+    const char *name;
+    int64_t *i64;               // Offsets
+    long *l;                    // Counters
+} checkpoint_field_t;
+
+// Checkpoint fields, by name
+static void checkpoint_fields(checkpoint_t *c, checkpoint_field_t *f) {
+    checkpoint_field_t fields[CHECKPOINT_NFIELDS] = {
+        {"in_offset", &c->in_offset, NULL},
+        {"out_offset", &c->out_offset, NULL},
+        {"read_num", NULL, &c->read_num},
+        {"count_written", NULL, &c->count_written},
+        {"count_mc", NULL, &c->count_mc},
+        {"count_mq", NULL, &c->count_mq},
+        {"count_ms", NULL, &c->count_ms},
+        {"count_fixmate", NULL, &c->count_fixmate},
+        {"count_removed", NULL, &c->count_removed},
+        {"count_filtered", NULL, &c->count_filtered},
+        {"count_error_no_umi", NULL, &c->count_errors[ERROR_NO_UMI]},
+        {"count_error_bad_tags", NULL, &c->count_errors[ERROR_BAD_TAGS]},
+    };
+    memcpy(f, fields, sizeof(fields));
+}
+
+typedef struct checkpoint_run_field_t {
+    const char *name;
+    const char *value;
+} checkpoint_run_field_t;
+
+// Run identity fields, by name. Values are compared as text ('num' holds the numbers)
+static void checkpoint_run_fields(const checkpoint_run_t *r, char num[2][24], checkpoint_run_field_t *f) {
+    snprintf(num[0], 24, "%" PRId64, r->input_size);
+    snprintf(num[1], 24, "%" PRId64, r->input_mtime);
+    checkpoint_run_field_t fields[CHECKPOINT_NRUN_FIELDS] = {
+        {"input", r->input ? r->input : ""},
+        {"input_size", num[0]},
+        {"input_mtime", num[1]},
+        {"options", r->options ? r->options : ""},
+        {"output_mode", r->output_mode ? r->output_mode : ""},
+    };
+    memcpy(f, fields, sizeof(fields));
+}
+
+/*
+ * Read a checkpoint file, saved by the run 'run' (same input file, options and output mode).
+ * Returns -1 on error (missing file, missing fields, different run)
+ */
+int checkpoint_read(const char *path, const checkpoint_run_t *run, checkpoint_t *c) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Error opening checkpoint \"%s\"\n", path);
+        return -1;
+    }
+
+    memset(c, 0, sizeof(checkpoint_t));
+    checkpoint_field_t fields[CHECKPOINT_NFIELDS];
+    checkpoint_fields(c, fields);
+    checkpoint_run_field_t run_fields[CHECKPOINT_NRUN_FIELDS];
+    char num[2][24];
+    checkpoint_run_fields(run, num, run_fields);
+    int found = 0, found_run = 0, ok = 1, version = 0;
+    char *line = NULL, name[64];
+    size_t m_line = 0;
+    ssize_t len;
+    if (getline(&line, &m_line, fp) < 0 || sscanf(line, "%63s %d", name, &version) != 2 || strcmp(name, CHECKPOINT_MAGIC) != 0) ok = 0;
+    if (ok && version != CHECKPOINT_VERSION) {
+        fprintf(stderr, "Error: Checkpoint \"%s\" has version %d, this version of umi_rx only reads version %d checkpoints\n", path, version, CHECKPOINT_VERSION);
+        ok = -1;
+    }
+    while (ok > 0 && (len = getline(&line, &m_line, fp)) > 0) {
+        if (line[len - 1] == '\n') line[--len] = '\0';
+        char *value = strchr(line, '\t');
+        if (!value) continue;
+        *value++ = '\0';
+        for (int i = 0; i < CHECKPOINT_NRUN_FIELDS; i++) {
+            if (strcmp(line, run_fields[i].name) != 0) continue;
+            if (strcmp(value, run_fields[i].value) != 0) {
+                fprintf(stderr, "Error: Checkpoint \"%s\" was saved by a different run: %s was '%s', now '%s'\n", path, line, value, run_fields[i].value);
+                ok = -1;
+            }
+            found_run |= 1 << i;
+        }
+        for (int i = 0; i < CHECKPOINT_NFIELDS; i++) {
+            if (strcmp(line, fields[i].name) != 0) continue;
+            char *end;
+            int64_t n = strtoll(value, &end, 10);
+            if (end == value || *end) continue;
+            if (fields[i].i64) *fields[i].i64 = n;
+            else *fields[i].l = (long) n;
+            found |= 1 << i;
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    if (ok < 0) return -1;
+    if (!ok || found != (1 << CHECKPOINT_NFIELDS) - 1 || found_run != (1 << CHECKPOINT_NRUN_FIELDS) - 1) {
+        fprintf(stderr, "Error: Invalid checkpoint \"%s\"\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Write a checkpoint file atomically: write 'path.tmp', fsync, rename to 'path'
+int checkpoint_write(const char *path, const checkpoint_run_t *run, const checkpoint_t *c) {
+    size_t len = strlen(path) + 5;
+    char *tmp = malloc(len);
+    if (!tmp) return -1;
+    snprintf(tmp, len, "%s.tmp", path);
+
+    int ret = -1;
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) {
+        fprintf(stderr, "Error writing checkpoint \"%s\"\n", tmp);
+        free(tmp);
+        return -1;
+    }
+
+    checkpoint_field_t fields[CHECKPOINT_NFIELDS];
+    checkpoint_fields((checkpoint_t *) c, fields);
+    checkpoint_run_field_t run_fields[CHECKPOINT_NRUN_FIELDS];
+    char num[2][24];
+    checkpoint_run_fields(run, num, run_fields);
+    fprintf(fp, "%s\t%d\n", CHECKPOINT_MAGIC, CHECKPOINT_VERSION);
+    for (int i = 0; i < CHECKPOINT_NRUN_FIELDS; i++)
+        fprintf(fp, "%s\t%s\n", run_fields[i].name, run_fields[i].value);
+    for (int i = 0; i < CHECKPOINT_NFIELDS; i++)
+        fprintf(fp, "%s\t%" PRId64 "\n", fields[i].name, fields[i].i64 ? *fields[i].i64 : (int64_t) *fields[i].l);
+
+    if (fflush(fp) == 0 && fsync(fileno(fp)) == 0) ret = 0;
+    if (fclose(fp) != 0) ret = -1;
+    if (ret == 0 && rename(tmp, path) < 0) ret = -1;
+    if (ret < 0) {
+        fprintf(stderr, "Error writing checkpoint \"%s\"\n", path);
+        unlink(tmp);
+    }
+    free(tmp);
+    return ret;
+}
@@ -0,0 +1,40 @@
+#ifndef UMI_RX_CHECKPOINT_H
+#define UMI_RX_CHECKPOINT_H
+
+#include <stdint.h>
+
+#include "tagger.h"
+
+/*
+ * Checkpoint of a run, so a preempted run can be resumed ('--resume'):
+ * the output is truncated to 'out_offset' (a BGZF block boundary, all records
+ * before it are complete) and reading continues at input virtual offset 'in_offset'.
+ *
+ * Checkpoints are small text files ('name\tvalue' lines), written atomically
+ * (temporary file, fsync, rename), so a crash never leaves a partial checkpoint.
+ * They identify the run (see 'checkpoint_run_t'): resuming a different run is an error.
+ */
+typedef struct checkpoint_t {
+    int64_t in_offset;          // Input virtual offset of the first record not yet written
+    int64_t out_offset;         // Output file size
+    long read_num;              // Records read
+    long count_written;         // Records written
+    long count_mc, count_mq, count_ms, count_fixmate;
+    long count_removed;         // Tags removed
+    long count_filtered;        // Records dropped by filters
+    long count_errors[ERROR_NCATEGORIES];   // Malformed records, by category
+} checkpoint_t;
+
+// Run identity: a checkpoint is only resumed by the same run
+typedef struct checkpoint_run_t {
+    char *input;                // Input file (real path)
+    int64_t input_size;
+    int64_t input_mtime;        // Input modification time (ns)
+    const char *options;        // Options changing the output (tags, filters, plugins...)
+    const char *output_mode;    // Output mode for hts_open (compression level)
+} checkpoint_run_t;
+
+int checkpoint_read(const char *path, const checkpoint_run_t *run, checkpoint_t *c);
+int checkpoint_write(const char *path, const checkpoint_run_t *run, const checkpoint_t *c);
+
+#endif
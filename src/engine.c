@@ -0,0 +1,550 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "htslib/bgzf.h"
+#include "htslib/hfile.h"
+#include "htslib/thread_pool.h"
+
+#include "engine.h"
+#include "probes.h"
+#include "umi_rx.h"
+
+void engine_init(engine_t *e) {
+    memset(e, 0, sizeof(engine_t));
+    tagger_init(&e->tagger);
+    e->checkpoint_every = ENGINE_CHECKPOINT_EVERY;
+    e->metrics_every = STATS_METRICS_EVERY;
+    e->max_group = ENGINE_MAX_GROUP;
+}
+
+void engine_destroy(engine_t *e) {
+    for (int i = 0; i < e->n_plugins; i++) plugin_unload(&e->plugins[i]);
+    free(e->plugins);
+    tagger_destroy(&e->tagger);
+    free(e->run.input);
+    e->run.input = NULL;
+    e->plugins = NULL;
+    e->n_plugins = 0;
+}
+
+// Load a plugin ('path.so[:args]'). Must be called before the output header is written
+int engine_load_plugin(engine_t *e, const char *spec, sam_hdr_t *header) {
+    plugin_t *plugins = realloc(e->plugins, (e->n_plugins + 1) * sizeof(plugin_t));
+    if (!plugins) return -1;
+    e->plugins = plugins;
+    if (plugin_load(&e->plugins[e->n_plugins], spec, header) < 0) return -1;
+    e->n_plugins++;
+    return 0;
+}
+
+// Make room for one more record in the batch
+static int batch_grow(bam_batch_t *b) {
+    if (b->n < b->m) return 0;
+    int m = b->m ? 2 * b->m : ENGINE_BATCH_SIZE + 1;
+    bam1_t **recs = realloc(b->recs, m * sizeof(bam1_t *));
+    if (!recs) return -1;
+    b->recs = recs;
+    long *read_nums = realloc(b->read_nums, m * sizeof(long));
+    if (!read_nums) return -1;
+    b->read_nums = read_nums;
+    for (int i = b->m; i < m; i++) {
+        if (!(b->recs[i] = bam_init1())) return -1;
+        b->m++;
+    }
+    return 0;
+}
+
+static void batch_destroy(bam_batch_t *b) {
+    for (int i = 0; i < b->m; i++) bam_destroy1(b->recs[i]);
+    free(b->recs);
+    free(b->read_nums);
+    mem_update(MEM_BATCHES, &b->mem, 0);
+}
+
+// Batch capacity: record array and records, including their data
+static int64_t batch_capacity(bam_batch_t *b) {
+    int64_t bytes = b->m * (int64_t) (sizeof(bam1_t *) + sizeof(long));
+    for (int i = 0; i < b->m; i++) bytes += sizeof(bam1_t) + b->recs[i]->m_data;
+    return bytes;
+}
+
+// Stop all pipeline stages
+static void engine_fail(engine_t *e) {
+    e->error = 1;
+    queue_close(e->q_empty);
+    queue_close(e->q_read);
+    queue_close(e->q_tagged);
+}
+
+// Input position after batch 'b': virtual offset of the next record to read (checkpoints only)
+static void batch_mark_end(engine_t *e, bam_batch_t *b) {
+    if (!e->checkpoint) return;
+    if (e->has_pending) {
+        b->ckpt.in_offset = e->pending_offset;
+        b->ckpt.read_num = e->read_num - 1;
+    } else {
+        b->ckpt.in_offset = bgzf_tell(hts_get_bgzfp(e->in));
+        b->ckpt.read_num = e->read_num;
+    }
+}
+
+/*
+ * Read a batch of records. In grouped mode the batch is extended until the read name changes,
+ * up to 'max_group' records past the batch size (memory is bounded on repeated read names).
+ * Returns the number of records, -1 on read error, -2 if a read name group is too large
+ */
+static int engine_read_batch(engine_t *e, bam_batch_t *b) {
+    b->n = 0;
+    b->first_read = e->read_num + 1 - e->has_pending;
+    for (;;) {
+        if (batch_grow(b) < 0) return -1;
+        int64_t offset = e->checkpoint ? bgzf_tell(hts_get_bgzfp(e->in)) : 0;
+
+        // Next record: pending from previous batch or from input
+        if (e->has_pending) {
+            bam1_t *tmp = b->recs[b->n];
+            b->recs[b->n] = e->pending;
+            e->pending = tmp;
+            e->has_pending = 0;
+        } else {
+            int ret = sam_read1(e->in, e->header, b->recs[b->n]);
+            if (ret < -1) return -1;
+            if (ret < 0) {
+                e->eof = 1;
+                batch_mark_end(e, b);
+                return b->n;
+            }
+            e->read_num++;
+        }
+
+        // Batch full? The record goes to the next batch
+        if (b->n >= ENGINE_BATCH_SIZE && (!e->grouped || strcmp(bam_get_qname(b->recs[b->n]), bam_get_qname(b->recs[b->n - 1])) != 0)) {
+            bam1_t *tmp = b->recs[b->n];
+            b->recs[b->n] = e->pending;
+            e->pending = tmp;
+            e->has_pending = 1;
+            e->pending_offset = offset;
+            batch_mark_end(e, b);
+            return b->n;
+        }
+
+        // All records past the batch size have the same name
+        if (b->n >= ENGINE_BATCH_SIZE + e->max_group) {
+            fprintf(stderr, "Error: Read name group larger than %d records, read_name='%s'. Use '--max-group' to increase the limit\n", e->max_group, bam_get_qname(b->recs[b->n]));
+            return -2;
+        }
+        b->n++;
+    }
+}
+
+// BAM record bytes in the batch (stats)
+static int64_t batch_bytes(bam_batch_t *b) {
+    int64_t bytes = 0;
+    for (int i = 0; i < b->n; i++) bytes += b->recs[i]->l_data + 36;  // block_size and fixed fields
+    return bytes;
+}
+
+// Reader thread
+static void *engine_reader(void *arg) {
+    engine_t *e = (engine_t *) arg;
+    bam_batch_t *b;
+    trace_buf_t *tb = trace_next(&e->trace, STAGE_READ);
+    int64_t wait = trace_begin(tb);
+    while (!e->eof && (b = queue_pop(e->q_empty)) != NULL) {
+        trace_end(tb, "wait_free_batch", wait, 0);
+        int64_t start = stats_now_ns();
+        int n = engine_read_batch(e, b);
+        if (n < 0) {
+            if (n == -1) fprintf(stderr, "Error reading input, read_number=%ld\n", e->read_num + 1);
+            engine_fail(e);
+            break;
+        }
+        if (n > 0) {
+            BGZF *bgzf = hts_get_bgzfp(e->in);
+            int64_t bytes = batch_bytes(b);
+            stage_stats_add(&e->stats.stage[STAGE_READ], n, bytes, stats_now_ns() - start);
+            UMI_PROBE3(batch_read, b->first_read, n, bytes);
+            if (bgzf) __atomic_store_n(&e->stats.stage[STAGE_READ].offset, bgzf_tell(bgzf), __ATOMIC_RELAXED);
+            trace_end(tb, "read", start, n);
+            wait = trace_begin(tb);
+            if (queue_push(e->q_read, b) < 0) break;
+            trace_end(tb, "wait_push", wait, 0);
+        }
+        tb = trace_next(&e->trace, STAGE_READ);
+        wait = trace_begin(tb);
+    }
+    queue_close(e->q_read);
+    return NULL;
+}
+
+// Flush file contents to disk
+static int sync_file(const char *path) {
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) return -1;
+    int ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+/*
+ * Write a checkpoint after batch 'b' has been written (at most every 'checkpoint_every' seconds).
+ * The output is flushed to a BGZF block boundary and synced before the checkpoint is written.
+ */
+static int engine_checkpoint(engine_t *e, bam_batch_t *b) {
+    time_t now = time(NULL);
+    if (now - e->checkpoint_last < e->checkpoint_every) return 0;
+    e->checkpoint_last = now;
+
+    BGZF *bgzf = hts_get_bgzfp(e->out);
+    if (bgzf_flush(bgzf) < 0 || hflush(bgzf->fp) < 0 || sync_file(e->fileout) < 0) {
+        fprintf(stderr, "Error flushing output \"%s\" for checkpoint\n", e->fileout);
+        return -1;
+    }
+
+    checkpoint_t c = b->ckpt;
+    c.out_offset = e->out_base + bgzf_htell(bgzf);
+    c.count_written = e->count_written;
+    return checkpoint_write(e->checkpoint, &e->run, &c);
+}
+
+// Copy counters to the batch, after the tag stage (checkpoints only)
+static void engine_snapshot(engine_t *e, bam_batch_t *b) {
+    if (!e->checkpoint) return;
+    tagger_t *t = &e->tagger;
+    b->ckpt.count_mc = t->mate.count_mc;
+    b->ckpt.count_mq = t->mate.count_mq;
+    b->ckpt.count_ms = t->mate.count_ms;
+    b->ckpt.count_fixmate = t->mate.count_fixmate;
+    b->ckpt.count_removed = t->count_removed;
+    b->ckpt.count_filtered = t->filter.count_filtered;
+    memcpy(b->ckpt.count_errors, t->count_errors, sizeof(t->count_errors));
+}
+
+// Writer thread
+static void *engine_writer(void *arg) {
+    engine_t *e = (engine_t *) arg;
+    bam_batch_t *b;
+    trace_buf_t *tb = trace_next(&e->trace, STAGE_WRITE);
+    int64_t wait = trace_begin(tb);
+    while ((b = queue_pop(e->q_tagged)) != NULL) {
+        trace_end(tb, "wait_tagged_batch", wait, 0);
+        int64_t start = stats_now_ns();
+        for (int i = 0; i < b->n; i++) {
+            bam1_t *aln = b->recs[i];
+            if (sam_write1(e->out, e->header, aln) < 0) {
+                const char *chr = aln->core.tid >= 0 ? e->header->target_name[aln->core.tid] : "*";
+                fprintf(stderr, "Error writing output alignment, chr='%s', pos=%ld, read_name='%s'\n", chr, (long) aln->core.pos + 1, bam_get_qname(aln));
+                engine_fail(e);
+                return NULL;
+            }
+        }
+        e->count_written += b->n;
+        BGZF *bgzf = hts_get_bgzfp(e->out);
+        int64_t bytes = batch_bytes(b);
+        stage_stats_add(&e->stats.stage[STAGE_WRITE], b->n, bytes, stats_now_ns() - start);
+        if (bgzf) {
+            int64_t voffset = bgzf_tell(bgzf);
+            int64_t offset = voffset >> 16, last = e->stats.stage[STAGE_WRITE].offset >> 16;
+            __atomic_store_n(&e->stats.stage[STAGE_WRITE].offset, voffset, __ATOMIC_RELAXED);
+            if (offset > last) UMI_PROBE2(block_written, offset - last, offset);
+            UMI_PROBE3(batch_written, b->n, bytes, offset);
+        } else {
+            UMI_PROBE3(batch_written, b->n, bytes, -1);
+        }
+        trace_end(tb, "write", start, b->n);
+        mem_update(MEM_BATCHES, &b->mem, batch_capacity(b));
+        for (int i = b->n; i < b->n + b->n_rejected; i++) {
+            if (sam_write1(e->reject, e->header, b->recs[i]) < 0) {
+                fprintf(stderr, "Error writing rejected record, read_name='%s'\n", bam_get_qname(b->recs[i]));
+                engine_fail(e);
+                return NULL;
+            }
+        }
+        start = trace_begin(tb);
+        if (e->checkpoint && engine_checkpoint(e, b) < 0) {
+            engine_fail(e);
+            return NULL;
+        }
+        if (e->checkpoint) trace_end(tb, "checkpoint", start, 0);
+        if (queue_push(e->q_empty, b) < 0) break;
+        tb = trace_next(&e->trace, STAGE_WRITE);
+        wait = trace_begin(tb);
+    }
+    return NULL;
+}
+
+// Tag stage: filter, built-in tags, mate tags (by read name) and plugins
+static int engine_process_batch(engine_t *e, bam_batch_t *b) {
+    for (int i = 0; i < b->n; i++) show_progress(b->first_read + i);
+
+    if ((b->n = tagger_filter(&e->tagger, e->header, b->recs, b->n, b->first_read, b->read_nums)) < 0) return -1;
+
+    // Records dropped by the error policy are after the kept ones
+    int kept = tagger_tag(&e->tagger, e->header, b->recs, b->n, b->read_nums);
+    if (kept < 0) return -1;
+    b->n_rejected = e->reject ? b->n - kept : 0;
+    b->n = kept;
+
+    for (int i = 0; i < e->n_plugins; i++)
+        if (plugin_process(&e->plugins[i], e->header, b->recs, b->n) < 0) return -1;
+
+    return 0;
+}
+
+/*
+ * Process all records from 'in' and write them to 'out'. The header must be already written.
+ * Returns -1 on error
+ */
+int engine_run(engine_t *e, htsFile *in, htsFile *out, sam_hdr_t *header) {
+    e->in = in;
+    e->out = out;
+    e->header = header;
+    tagger_prepare(&e->tagger);
+    e->grouped = tagger_grouped(&e->tagger);
+    for (int i = 0; i < e->n_plugins; i++)
+        if (e->plugins[i].info->flags & UMI_PLUGIN_NAME_GROUPS) e->grouped = 1;
+
+    e->pending = bam_init1();
+    e->batches = calloc(ENGINE_NBATCHES, sizeof(bam_batch_t));
+    e->q_empty = queue_init(ENGINE_NBATCHES);
+    e->q_read = queue_init(ENGINE_NBATCHES);
+    e->q_tagged = queue_init(ENGINE_NBATCHES);
+    for (int i = 0; i < ENGINE_NBATCHES; i++) queue_push(e->q_empty, &e->batches[i]);
+
+    if (trace_init(&e->trace, e->trace_file, e->trace_sample) < 0) {
+        fprintf(stderr, "Error allocating trace buffers\n");
+        engine_fail(e);
+    }
+
+    stats_server_t stats_server;
+    stats_init(&e->stats);
+    if (stats_server_start(&stats_server, e) < 0) {
+        fprintf(stderr, "Error starting stats server\n");
+        engine_fail(e);
+    }
+
+    pthread_t reader, writer;
+    int has_reader = pthread_create(&reader, NULL, engine_reader, e) == 0;
+    int has_writer = pthread_create(&writer, NULL, engine_writer, e) == 0;
+    if (!has_reader || !has_writer) {
+        fprintf(stderr, "Error creating pipeline threads\n");
+        engine_fail(e);
+    }
+
+    // Tag stage runs in the calling thread
+    bam_batch_t *b;
+    trace_buf_t *tb = trace_next(&e->trace, STAGE_TAG);
+    int64_t wait = trace_begin(tb);
+    while ((b = queue_pop(e->q_read)) != NULL) {
+        trace_end(tb, "wait_read_batch", wait, 0);
+        int64_t start = stats_now_ns();
+        if (engine_process_batch(e, b) < 0) {
+            engine_fail(e);
+            break;
+        }
+        engine_snapshot(e, b);
+        UMI_PROBE2(batch_tagged, b->n, b->n_rejected);
+        stage_stats_add(&e->stats.stage[STAGE_TAG], b->n, 0, stats_now_ns() - start);
+        stats_publish_tags(&e->stats, &e->tagger);
+        mem_update(MEM_MATE, &e->mem_mate, e->tagger.mate.cigar1.m + e->tagger.mate.cigar2.m);
+        trace_end(tb, "tag", start, b->n);
+        wait = trace_begin(tb);
+        if (queue_push(e->q_tagged, b) < 0) break;
+        trace_end(tb, "wait_push", wait, 0);
+        tb = trace_next(&e->trace, STAGE_TAG);
+        wait = trace_begin(tb);
+    }
+    queue_close(e->q_tagged);
+
+    if (has_reader) pthread_join(reader, NULL);
+    if (has_writer) pthread_join(writer, NULL);
+    stats_server_stop(&stats_server);
+    mem_update(MEM_MATE, &e->mem_mate, 0);
+    if (trace_write(&e->trace) < 0) e->error = 1;
+    trace_destroy(&e->trace);
+
+    for (int i = 0; i < ENGINE_NBATCHES; i++) batch_destroy(&e->batches[i]);
+    free(e->batches);
+    queue_destroy(e->q_empty);
+    queue_destroy(e->q_read);
+    queue_destroy(e->q_tagged);
+    bam_destroy1(e->pending);
+    e->batches = NULL;
+    e->pending = NULL;
+
+    return e->error ? -1 : 0;
+}
+
+// Identify the run in checkpoints: input file (real path, size, modification time), options and output mode
+static int engine_checkpoint_run(engine_t *e, const char *filein, const char *modew) {
+    struct stat st;
+    char *input = realpath(filein, NULL);
+    if (!input || stat(input, &st) < 0) {
+        fprintf(stderr, "Error opening \"%s\"\n", filein);
+        free(input);
+        return -1;
+    }
+    checkpoint_run_t *r = &e->run;
+    free(r->input);
+    r->input = input;
+    r->input_size = st.st_size;
+    r->input_mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    r->options = e->options;
+    r->output_mode = modew;
+    return 0;
+}
+
+/*
+ * Resume from a checkpoint saved by the same run: truncate the output to the checkpoint's size
+ * and restore counters. The input is positioned after the header is read.
+ */
+static int engine_resume(engine_t *e, const char *fileout, checkpoint_t *c) {
+    if (checkpoint_read(e->checkpoint, &e->run, c) < 0) return -1;
+
+    struct stat st;
+    if (stat(fileout, &st) < 0 || st.st_size < c->out_offset) {
+        fprintf(stderr, "Error: Output \"%s\" is missing or shorter than checkpoint \"%s\"\n", fileout, e->checkpoint);
+        return -1;
+    }
+    if (truncate(fileout, c->out_offset) < 0) {
+        fprintf(stderr, "Error truncating \"%s\"\n", fileout);
+        return -1;
+    }
+
+    tagger_t *t = &e->tagger;
+    e->read_num = c->read_num;
+    e->count_written = c->count_written;
+    e->out_base = c->out_offset;
+    t->mate.count_mc = c->count_mc;
+    t->mate.count_mq = c->count_mq;
+    t->mate.count_ms = c->count_ms;
+    t->mate.count_fixmate = c->count_fixmate;
+    t->count_removed = c->count_removed;
+    t->filter.count_filtered = c->count_filtered;
+    memcpy(t->count_errors, c->count_errors, sizeof(t->count_errors));
+    fprintf(stderr, "Resuming from checkpoint \"%s\": %ld reads processed, output truncated to %lld bytes\n", e->checkpoint, e->read_num, (long long) c->out_offset);
+    return 0;
+}
+
+/*
+ * Open input / output files, load plugins, run the pipeline and close the files.
+ * 'modew' is the output mode for hts_open (e.g. "wb", "wb1", "w" for SAM).
+ * Counters are available in the engine / tagger after the run.
+ *
+ * Checkpoints ('e->checkpoint') require BAM input and output files (not STDIN / STDOUT).
+ * When resuming, the output is appended to and the header is not written again.
+ */
+int engine_run_files(engine_t *e, const char *filein, const char *fileout, const char *modew, int threads, char **plugins, int n_plugins) {
+    int ret = -1;
+    htsFile *in = NULL, *out = NULL;
+    sam_hdr_t *header = NULL;
+
+    // Checkpoints: resume appends to the output
+    checkpoint_t ckpt;
+    char mode[8];
+    snprintf(mode, sizeof(mode), "%s", modew);
+    int resume = e->checkpoint && e->resume;
+    if (e->checkpoint) {
+        if (e->reject_file) {
+            fprintf(stderr, "Error: Checkpoints can't be used with a reject file\n");
+            return -1;
+        }
+        if (strcmp(filein, "-") == 0 || strcmp(fileout, "-") == 0) {
+            fprintf(stderr, "Error: Checkpoints require input and output files (not STDIN / STDOUT)\n");
+            return -1;
+        }
+        if (engine_checkpoint_run(e, filein, modew) < 0) return -1;
+        if (resume) {
+            if (engine_resume(e, fileout, &ckpt) < 0) return -1;
+            mode[0] = 'a';
+        }
+        e->fileout = fileout;
+        e->checkpoint_last = time(NULL);
+    }
+
+    // Thread pool shared by input and output
+    htsThreadPool tp = {NULL, 0};
+    if (threads > 0 && !(tp.pool = hts_tpool_init(threads))) {
+        fprintf(stderr, "Error creating thread pool\n");
+        return -1;
+    }
+
+    // Open in.bam
+    if (!(in = hts_open(filein, "r"))) {
+        fprintf(stderr, "Error opening \"%s\"\n", filein);
+        goto cleanup;
+    }
+
+    // Open out.bam
+    if (!(out = hts_open(fileout, mode))) {
+        fprintf(stderr, "Error opening \"%s\"\n", fileout);
+        goto cleanup;
+    }
+
+    if (e->checkpoint && (!hts_get_bgzfp(in) || !hts_get_bgzfp(out))) {
+        fprintf(stderr, "Error: Checkpoints require BAM input and output\n");
+        goto cleanup;
+    }
+
+    // Open reject file
+    if (e->reject_file && !(e->reject = hts_open(e->reject_file, "wb"))) {
+        fprintf(stderr, "Error opening \"%s\"\n", e->reject_file);
+        goto cleanup;
+    }
+
+    if (tp.pool) {
+        hts_set_thread_pool(in, &tp);
+        hts_set_thread_pool(out, &tp);
+        if (e->reject) hts_set_thread_pool(e->reject, &tp);
+    }
+
+    // Read header
+    if (!(header = sam_hdr_read(in))) {
+        fprintf(stderr, "Couldn't read header for \"%s\"\n", filein);
+        goto cleanup;
+    }
+
+    // Plugins may add header lines
+    for (int i = 0; i < n_plugins; i++)
+        if (engine_load_plugin(e, plugins[i], header) < 0) goto cleanup;
+
+    if (resume) {
+        // Header is already in the output, continue reading after the last checkpoint
+        if (bgzf_seek(hts_get_bgzfp(in), ckpt.in_offset, SEEK_SET) < 0) {
+            fprintf(stderr, "Error seeking \"%s\" to checkpoint offset\n", filein);
+            goto cleanup;
+        }
+    } else if (sam_hdr_write(out, header) < 0) {
+        fprintf(stderr, "Error writing output header.\n");
+        goto cleanup;
+    }
+    if (e->reject && sam_hdr_write(e->reject, header) < 0) {
+        fprintf(stderr, "Error writing header to \"%s\"\n", e->reject_file);
+        goto cleanup;
+    }
+
+    ret = engine_run(e, in, out, header);
+
+cleanup:
+    if (out && hts_close(out) < 0) {
+        fprintf(stderr, "Error closing \"%s\"\n", fileout);
+        ret = -1;
+    }
+    if (e->reject && hts_close(e->reject) < 0) {
+        fprintf(stderr, "Error closing \"%s\"\n", e->reject_file);
+        ret = -1;
+    }
+    e->reject = NULL;
+    if (in && hts_close(in) < 0) {
+        fprintf(stderr, "Error closing \"%s\"\n", filein);
+        ret = -1;
+    }
+    if (header) sam_hdr_destroy(header);
+    if (tp.pool) hts_tpool_destroy(tp.pool);
+    if (ret == 0 && e->checkpoint) unlink(e->checkpoint); // Finished, nothing to resume
+    return ret;
+}
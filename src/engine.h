@@ -0,0 +1,96 @@
+#ifndef UMI_RX_ENGINE_H
+#define UMI_RX_ENGINE_H
+
+#include <pthread.h>
+#include <time.h>
+
+#include "htslib/sam.h"
+
+#include "checkpoint.h"
+#include "mem.h"
+#include "plugin.h"
+#include "queue.h"
+#include "stats.h"
+#include "tagger.h"
+#include "trace.h"
+
+#define ENGINE_BATCH_SIZE 4096  // Records per batch
+#define ENGINE_NBATCHES 8       // Batches in flight
+#define ENGINE_MAX_GROUP 100000 // Default maximum records in a read name group (grouped mode)
+#define ENGINE_CHECKPOINT_EVERY 60  // Default seconds between checkpoints
+
+// Batch of records flowing through the pipeline
+typedef struct bam_batch_t {
+    bam1_t **recs;
+    int n, m;               // Number of records in the batch / allocated
+    int n_rejected;         // Records rejected by the error policy (after the first 'n')
+    long first_read;        // Read number of the first record
+    long *read_nums;        // Read number of each record kept by filters
+    checkpoint_t ckpt;      // Input offset and counters after this batch (checkpoints only)
+    int64_t mem;            // Bytes accounted (MEM_BATCHES)
+} bam_batch_t;
+
+/*
+ * Tagging engine: a three stage pipeline
+ *      reader thread -> tag (calling thread) -> writer thread
+ * BGZF (de)compression is done by the htslib thread pool of the input / output files.
+ * When records need to be processed by read name (mate tags, some plugins)
+ * batches never split records having the same name.
+ */
+typedef struct engine_t {
+    // Options
+    tagger_t tagger;        // Filters, tags to add / remove, quality binning
+    plugin_t *plugins;
+    int n_plugins;
+    int max_group;          // Maximum records in a read name group (grouped mode)
+
+    // Counters
+    long read_num;          // Records read
+    long count_written;     // Records written
+
+    // Records rejected by the error policy ('reject:FILE')
+    const char *reject_file;
+    htsFile *reject;
+
+    // Checkpoints
+    const char *checkpoint; // Checkpoint file, NULL for none
+    int checkpoint_every;   // Seconds between checkpoints
+    int resume;             // Resume from the checkpoint
+    const char *options;    // Options changing the output: a resumed run must have the same ones
+    checkpoint_run_t run;   // Input file, options and output mode saved in checkpoints
+    time_t checkpoint_last; // Time of the last checkpoint
+    const char *fileout;    // Output file, synced before each checkpoint
+    int64_t out_base;       // Output file size when it was opened (resumed runs)
+    int64_t pending_offset; // Input virtual offset of the pending record
+
+    // Live stats
+    const char *stats_socket; // Unix socket serving stats, NULL for none
+    int stats_signal;       // Dump stats to stderr on SIGUSR1
+    const char *metrics_file; // Prometheus textfile, NULL for none
+    int metrics_every;      // Seconds between metrics files
+    stats_t stats;
+
+    // Timeline of pipeline stages
+    const char *trace_file; // Chrome trace event JSON, NULL for none
+    int trace_sample;       // Record one batch every 'trace_sample'
+    trace_t trace;
+
+    // Pipeline
+    htsFile *in, *out;
+    sam_hdr_t *header;
+    int grouped;            // Batches end at read name boundaries
+    bam_batch_t *batches;
+    queue_t *q_empty, *q_read, *q_tagged;
+    bam1_t *pending;        // First record of the next batch
+    int64_t mem_mate;       // Bytes accounted (MEM_MATE)
+    int has_pending, eof;
+    volatile int error;
+} engine_t;
+
+void engine_init(engine_t *e);
+void engine_destroy(engine_t *e);
+int engine_load_plugin(engine_t *e, const char *spec, sam_hdr_t *header);
+int engine_run(engine_t *e, htsFile *in, htsFile *out, sam_hdr_t *header);
+int engine_run_files(engine_t *e, const char *filein, const char *fileout, const char *modew, int threads, char **plugins, int n_plugins);
+
+#endif
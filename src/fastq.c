@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fastq.h"
+
+// Remove trailing '\r' (FASTQ files with DOS line endings)
+static inline void chomp(kstring_t *line) {
+    if (line->l > 0 && line->s[line->l - 1] == '\r') line->s[--line->l] = '\0';
+}
+
+/*
+ * Parse one FASTQ record (four lines) and append it to the batch
+ * Returns 1 on success, 0 on EOF and -1 on error
+ */
+static int fastq_read_rec(fastq_reader_t *r, fastq_batch_t *b, kstring_t *line) {
+    fastq_rec_t *rec = &b->rec[b->n];
+    long rec_num = r->nrecs + 1;
+
+    // Header line: '@name [comment]'
+    int ret = bgzf_getline(r->fp, '\n', line);
+    if (ret == -1) return 0;
+    chomp(line);
+    if (ret < -1 || line->l == 0 || line->s[0] != '@') {
+        fprintf(stderr, "Error: Invalid FASTQ header line, file '%s', record %ld\n", r->fn, rec_num);
+        return -1;
+    }
+    int l_name = 1;
+    while (l_name < (int) line->l && line->s[l_name] != ' ' && line->s[l_name] != '\t') l_name++;
+    l_name--; // Skip '@'
+    if (l_name > 2 && line->s[l_name - 1] == '/' && (line->s[l_name] == '1' || line->s[l_name] == '2')) l_name -= 2;
+    rec->name = b->buf.l;
+    rec->l_name = l_name;
+    kputsn(line->s + 1, l_name, &b->buf);
+    kputc('\0', &b->buf);
+
+    // Sequence line
+    if (bgzf_getline(r->fp, '\n', line) < 0) {
+        fprintf(stderr, "Error: Truncated FASTQ record, file '%s', record %ld\n", r->fn, rec_num);
+        return -1;
+    }
+    chomp(line);
+    rec->seq = b->buf.l;
+    rec->l_seq = line->l;
+    kputsn(line->s, line->l, &b->buf);
+    kputc('\0', &b->buf);
+
+    // Separator line
+    if (bgzf_getline(r->fp, '\n', line) < 0 || line->l == 0 || line->s[0] != '+') {
+        fprintf(stderr, "Error: Invalid FASTQ separator line, file '%s', record %ld\n", r->fn, rec_num);
+        return -1;
+    }
+
+    // Quality line, stored as Phred values
+    if (bgzf_getline(r->fp, '\n', line) < 0) {
+        fprintf(stderr, "Error: Truncated FASTQ record, file '%s', record %ld\n", r->fn, rec_num);
+        return -1;
+    }
+    chomp(line);
+    if ((int) line->l != rec->l_seq) {
+        fprintf(stderr, "Error: Sequence and quality lengths differ, file '%s', record %ld\n", r->fn, rec_num);
+        return -1;
+    }
+    rec->qual = b->buf.l;
+    if (ks_resize(&b->buf, b->buf.l + line->l + 1) < 0) return -1;
+    char *qual = b->buf.s + b->buf.l;
+    for (size_t i = 0; i < line->l; i++) {
+        uint8_t c = line->s[i];
+        if (__builtin_expect(c < '!' || c > '~', 0)) {
+            fprintf(stderr, "Error: Invalid quality character 0x%02x, file '%s', record %ld, read_name='%s'\n", c, r->fn, rec_num, b->buf.s + rec->name);
+            return -1;
+        }
+        qual[i] = c - 33;
+    }
+    b->buf.l += line->l;
+
+    r->nrecs++;
+    return 1;
+}
+
+// Reader thread: fill empty batches until EOF
+static void *fastq_reader_thread(void *arg) {
+    fastq_reader_t *r = (fastq_reader_t *) arg;
+    kstring_t line = KS_INITIALIZE;
+    fastq_batch_t *b;
+
+    while ((b = queue_pop(r->empty)) != NULL) {
+        int ret = 1;
+        b->n = 0;
+        b->buf.l = 0;
+        while (b->n < FASTQ_BATCH_SIZE && (ret = fastq_read_rec(r, b, &line)) > 0) b->n++;
+        if (ret < 0) {
+            __atomic_store_n(&r->error, 1, __ATOMIC_RELEASE);
+            break;
+        }
+        if (b->n > 0 && queue_push(r->full, b) < 0) break;
+        if (ret == 0) break; // EOF
+    }
+
+    ks_free(&line);
+    queue_close(r->full);
+    return NULL;
+}
+
+/*
+ * Open a (gzipped) FASTQ file and start the reader thread.
+ * Use '-' for STDIN
+ */
+fastq_reader_t *fastq_reader_open(const char *fn, hts_tpool *pool) {
+    fastq_reader_t *r = calloc(1, sizeof(fastq_reader_t));
+    if (!r) return NULL;
+    r->fn = strdup(fn);
+    r->fp = strcmp(fn, "-") ? bgzf_open(fn, "r") : bgzf_dopen(STDIN_FILENO, "r");
+    if (!r->fp) {
+        fprintf(stderr, "Error opening \"%s\"\n", fn);
+        free(r->fn);
+        free(r);
+        return NULL;
+    }
+
+    // Multi-threaded inflate (only used if the file is BGZF compressed)
+    if (pool && bgzf_thread_pool(r->fp, pool, 0) < 0) {
+        fprintf(stderr, "Error setting thread pool for \"%s\"\n", fn);
+        bgzf_close(r->fp);
+        free(r->fn);
+        free(r);
+        return NULL;
+    }
+
+    r->batches = calloc(FASTQ_NBATCHES, sizeof(fastq_batch_t));
+    r->full = queue_init(FASTQ_NBATCHES);
+    r->empty = queue_init(FASTQ_NBATCHES);
+    for (int i = 0; i < FASTQ_NBATCHES; i++) queue_push(r->empty, &r->batches[i]);
+
+    if (pthread_create(&r->thread, NULL, fastq_reader_thread, r) != 0) {
+        fprintf(stderr, "Error creating reader thread for \"%s\"\n", fn);
+        r->error = 1;
+        queue_close(r->full);
+        queue_close(r->empty);
+        fastq_reader_close(r);
+        return NULL;
+    }
+    r->started = 1;
+    return r;
+}
+
+// Next batch of records, NULL on EOF or error (check 'fastq_reader_error')
+fastq_batch_t *fastq_reader_next(fastq_reader_t *r) {
+    return (fastq_batch_t *) queue_pop(r->full);
+}
+
+// Did the reader thread fail? Can be called while the thread is running
+int fastq_reader_error(fastq_reader_t *r) {
+    return __atomic_load_n(&r->error, __ATOMIC_ACQUIRE);
+}
+
+// Give a batch back to the reader thread
+void fastq_reader_release(fastq_reader_t *r, fastq_batch_t *b) {
+    queue_push(r->empty, b);
+}
+
+// Stop the reader thread and free memory. Returns -1 if there was an error reading the file
+int fastq_reader_close(fastq_reader_t *r) {
+    if (!r) return 0;
+    queue_close(r->empty);
+    queue_close(r->full);
+    if (r->started) pthread_join(r->thread, NULL);
+
+    int ret = r->error ? -1 : 0;
+    if (bgzf_close(r->fp) < 0) ret = -1;
+    for (int i = 0; i < FASTQ_NBATCHES; i++) ks_free(&r->batches[i].buf);
+    free(r->batches);
+    queue_destroy(r->full);
+    queue_destroy(r->empty);
+    free(r->fn);
+    free(r);
+    return ret;
+}
@@ -0,0 +1,54 @@
+#ifndef UMI_RX_FASTQ_H
+#define UMI_RX_FASTQ_H
+
+#include <pthread.h>
+
+#include "htslib/bgzf.h"
+#include "htslib/kstring.h"
+#include "queue.h"
+
+#define FASTQ_BATCH_SIZE 4096   // Records per batch
+#define FASTQ_NBATCHES 8        // Batches in flight per reader
+
+/*
+ * One FASTQ record, stored as offsets into the batch buffer.
+ * Names are trimmed at the first whitespace and '/1', '/2' suffixes are removed.
+ * Qualities are converted to Phred values (i.e. '+33' offset removed).
+ */
+typedef struct fastq_rec_t {
+    size_t name, seq, qual;
+    int l_name, l_seq;
+} fastq_rec_t;
+
+typedef struct fastq_batch_t {
+    int n;                  // Number of records in this batch
+    kstring_t buf;          // Names, sequences and qualities of all records
+    fastq_rec_t rec[FASTQ_BATCH_SIZE];
+} fastq_batch_t;
+
+#define fastq_name(b, i) ((b)->buf.s + (b)->rec[i].name)
+#define fastq_seq(b, i) ((b)->buf.s + (b)->rec[i].seq)
+#define fastq_qual(b, i) ((b)->buf.s + (b)->rec[i].qual)
+
+/*
+ * FASTQ reader: a dedicated thread decompresses and parses the file into batches.
+ * BGZF compressed inputs are also inflated in parallel by the thread pool
+ */
+typedef struct fastq_reader_t {
+    char *fn;
+    BGZF *fp;
+    pthread_t thread;
+    queue_t *full, *empty;      // Parsed batches / batches ready to be reused
+    fastq_batch_t *batches;
+    long nrecs;                 // Number of records parsed
+    int started;
+    int error;                  // Set by the reader thread, read with 'fastq_reader_error'
+} fastq_reader_t;
+
+fastq_reader_t *fastq_reader_open(const char *fn, hts_tpool *pool);
+fastq_batch_t *fastq_reader_next(fastq_reader_t *r);
+int fastq_reader_error(fastq_reader_t *r);
+void fastq_reader_release(fastq_reader_t *r, fastq_batch_t *b);
+int fastq_reader_close(fastq_reader_t *r);
+
+#endif
@@ -0,0 +1,225 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "htslib/sam.h"
+#include "htslib/thread_pool.h"
+
+#include "fastq.h"
+#include "qual_bin.h"
+#include "umi_rx.h"
+
+#define FLAG_R1 (BAM_FPAIRED | BAM_FUNMAP | BAM_FMUNMAP | BAM_FREAD1)
+#define FLAG_R2 (BAM_FPAIRED | BAM_FUNMAP | BAM_FMUNMAP | BAM_FREAD2)
+
+static void usage_fastq(FILE *fp) {
+    fprintf(fp,
+            "Usage: umi_rx fastq [options] R1.fastq.gz R2.fastq.gz output.bam\n"
+            "\n"
+            "Convert paired FASTQ files to an unaligned BAM, adding UMIs as 'RX' tag.\n"
+            "UMIs are read from the index FASTQ files (if any) or from the read name.\n"
+            "\n"
+            "Options:\n"
+            "  --i1 FILE           Index FASTQ carrying UMIs (I1)\n"
+            "  --i2 FILE           Index FASTQ carrying UMIs (I2). Dual UMIs are joined by '-'\n"
+            "  -r, --read-group ID Add '@RG' header line and 'RG' tag\n"
+            "  -s, --sample NAME   Sample name for the read group. Default: read group ID\n"
+            "  -b, --qual-bin SPEC Bin base qualities: 'illumina' (8 levels) or 'lower_bound:value,...'\n"
+            "  -l, --level INT     Compression level for output BAM\n"
+            "  -@, --threads INT   Number of threads for (de)compression. Default: 0\n");
+}
+
+// Check that read names from two FASTQ files match
+static int check_names(fastq_batch_t *b1, fastq_batch_t *b2, int i, const char *fn2) {
+    if (b1->rec[i].l_name == b2->rec[i].l_name && memcmp(fastq_name(b1, i), fastq_name(b2, i), b1->rec[i].l_name) == 0) return 1;
+    fprintf(stderr, "Error: Read names do not match, read_name='%s', file '%s' read_name='%s'\n", fastq_name(b1, i), fn2, fastq_name(b2, i));
+    return 0;
+}
+
+// Add UMI from index reads (or from read name) to the 'ubuf' string
+static int build_umi(fastq_batch_t *b1, fastq_batch_t *bi1, fastq_batch_t *bi2, int i, kstring_t *ubuf) {
+    ubuf->l = 0;
+    if (bi1) kputsn(fastq_seq(bi1, i), bi1->rec[i].l_seq, ubuf);
+    if (bi1 && bi2) kputc('-', ubuf);
+    if (bi2) kputsn(fastq_seq(bi2, i), bi2->rec[i].l_seq, ubuf);
+    if (bi1 || bi2) return 0;
+
+    char *umi = umi_from_name(fastq_name(b1, i));
+    if (!umi) {
+        fprintf(stderr, "Error: Could not find UMI from read name, read_name='%s'\n", fastq_name(b1, i));
+        return -1;
+    }
+    kputs(umi, ubuf);
+    return 0;
+}
+
+// Create an unaligned record, with 'RX' (and 'RG') tags
+static int set_record(bam1_t *aln, fastq_batch_t *b, int i, uint16_t flag, kstring_t *umi, const char *rg, const qual_bin_t *qual_bin) {
+    size_t l_aux = 3 + umi->l + 1 + (rg ? 3 + strlen(rg) + 1 : 0);
+    fastq_rec_t *rec = &b->rec[i];
+    if (bam_set1(aln, rec->l_name, fastq_name(b, i), flag, -1, -1, 0, 0, NULL, -1, -1, 0, rec->l_seq, fastq_seq(b, i), fastq_qual(b, i), l_aux) < 0) {
+        fprintf(stderr, "Error creating record, read_name='%s'\n", fastq_name(b, i));
+        return -1;
+    }
+    if (qual_bin) qual_bin_apply(qual_bin, bam_get_qual(aln), aln->core.l_qseq);
+    if (bam_aux_append(aln, "RX", 'Z', umi->l + 1, (uint8_t *) umi->s) < 0) {
+        fprintf(stderr, "Error updating RX tag");
+        return -1;
+    }
+    if (rg && bam_aux_append(aln, "RG", 'Z', strlen(rg) + 1, (uint8_t *) rg) < 0) {
+        fprintf(stderr, "Error updating RG tag");
+        return -1;
+    }
+    return 0;
+}
+
+// Unaligned BAM header: no references, grouped by query name
+static sam_hdr_t *create_header(const char *rg, const char *sample) {
+    sam_hdr_t *header = sam_hdr_init();
+    if (!header) return NULL;
+    if (sam_hdr_add_line(header, "HD", "VN", "1.6", "SO", "unsorted", "GO", "query", NULL) < 0) return NULL;
+    if (rg && sam_hdr_add_line(header, "RG", "ID", rg, "SM", sample ? sample : rg, NULL) < 0) return NULL;
+    if (sam_hdr_add_pg(header, "umi_rx", "VN", UMI_RX_VERSION, "CL", umi_rx_cmdline, NULL) < 0) return NULL;
+    return header;
+}
+
+int main_fastq(int argc, char **argv) {
+    static const struct option lopts[] = {
+        {"i1", required_argument, NULL, 1},
+        {"i2", required_argument, NULL, 2},
+        {"read-group", required_argument, NULL, 'r'},
+        {"sample", required_argument, NULL, 's'},
+        {"qual-bin", required_argument, NULL, 'b'},
+        {"level", required_argument, NULL, 'l'},
+        {"threads", required_argument, NULL, '@'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    char *fni1 = NULL, *fni2 = NULL, *rg = NULL, *sample = NULL;
+    qual_bin_t qual_bin, *pqual_bin = NULL;
+    int level = -1, threads = 0, c;
+    while ((c = getopt_long(argc, argv, "r:s:b:l:@:h", lopts, NULL)) >= 0) {
+        switch (c) {
+        case 1: fni1 = optarg; break;
+        case 2: fni2 = optarg; break;
+        case 'r': rg = optarg; break;
+        case 's': sample = optarg; break;
+        case 'b':
+            if (qual_bin_init(&qual_bin, optarg) < 0) return 1;
+            pqual_bin = &qual_bin;
+            break;
+        case 'l': level = atoi(optarg); break;
+        case '@': threads = atoi(optarg); break;
+        case 'h': usage_fastq(stdout); return 0;
+        default: usage_fastq(stderr); return 1;
+        }
+    }
+    if (argc - optind != 3) {
+        usage_fastq(stderr);
+        return 1;
+    }
+
+    char *fnr1 = argv[optind], *fnr2 = argv[optind + 1];
+    char *fileout = argv[optind + 2];
+
+    // Thread pool shared by all inputs and the output
+    htsThreadPool tp = {NULL, 0};
+    if (threads > 0 && !(tp.pool = hts_tpool_init(threads))) {
+        fprintf(stderr, "Error creating thread pool\n");
+        exit(1);
+    }
+
+    // Open FASTQ files, each one is parsed in its own thread
+    fastq_reader_t *r1 = fastq_reader_open(fnr1, tp.pool);
+    fastq_reader_t *r2 = fastq_reader_open(fnr2, tp.pool);
+    fastq_reader_t *ri1 = fni1 ? fastq_reader_open(fni1, tp.pool) : NULL;
+    fastq_reader_t *ri2 = fni2 ? fastq_reader_open(fni2, tp.pool) : NULL;
+    if (!r1 || !r2 || (fni1 && !ri1) || (fni2 && !ri2)) exit(1);
+
+    // Open out.bam
+    char modew[8] = "wb";
+    if (level >= 0) snprintf(modew, sizeof(modew), "wb%d", level > 9 ? 9 : level);
+    htsFile *out = hts_open(fileout, modew);
+    if (!out) {
+        fprintf(stderr, "Error opening \"%s\"\n", fileout);
+        exit(1);
+    }
+    if (tp.pool) hts_set_thread_pool(out, &tp);
+
+    // Write header
+    sam_hdr_t *header = create_header(rg, sample);
+    if (!header || sam_hdr_write(out, header) < 0) {
+        fprintf(stderr, "Error writing output header.\n");
+        exit(1);
+    }
+
+    // Output batch: records are built in place, then written
+    bam1_t **alns = calloc(2 * FASTQ_BATCH_SIZE, sizeof(bam1_t *));
+    for (int i = 0; i < 2 * FASTQ_BATCH_SIZE; i++) alns[i] = bam_init1();
+    kstring_t umi = KS_INITIALIZE;
+
+    long read_num = 0;
+    for (;;) {
+        fastq_batch_t *b1 = fastq_reader_next(r1);
+        fastq_batch_t *b2 = fastq_reader_next(r2);
+        fastq_batch_t *bi1 = ri1 ? fastq_reader_next(ri1) : NULL;
+        fastq_batch_t *bi2 = ri2 ? fastq_reader_next(ri2) : NULL;
+        if (!b1 && !b2 && (!ri1 || !bi1) && (!ri2 || !bi2)) break; // All files finished
+
+        // All readers produce full batches, so batches must have the same size
+        int n = b1 ? b1->n : -1;
+        if (!b1 || !b2 || b2->n != n || (ri1 && (!bi1 || bi1->n != n)) || (ri2 && (!bi2 || bi2->n != n))) {
+            if (fastq_reader_error(r1) || fastq_reader_error(r2) || (ri1 && fastq_reader_error(ri1)) || (ri2 && fastq_reader_error(ri2))) exit(1);
+            fprintf(stderr, "Error: FASTQ files have different number of reads, after %ld reads\n", read_num);
+            exit(1);
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (!check_names(b1, b2, i, fnr2)) exit(1);
+            if (bi1 && !check_names(b1, bi1, i, fni1)) exit(1);
+            if (bi2 && !check_names(b1, bi2, i, fni2)) exit(1);
+            if (build_umi(b1, bi1, bi2, i, &umi) < 0) exit(1);
+            if (set_record(alns[2 * i], b1, i, FLAG_R1, &umi, rg, pqual_bin) < 0) exit(1);
+            if (set_record(alns[2 * i + 1], b2, i, FLAG_R2, &umi, rg, pqual_bin) < 0) exit(1);
+        }
+
+        // Input batches can be reused by the reader threads
+        fastq_reader_release(r1, b1);
+        fastq_reader_release(r2, b2);
+        if (bi1) fastq_reader_release(ri1, bi1);
+        if (bi2) fastq_reader_release(ri2, bi2);
+
+        // Write batch (compression is done by the thread pool)
+        for (int i = 0; i < 2 * n; i++) {
+            if (sam_write1(out, header, alns[i]) < 0) {
+                fprintf(stderr, "Error writing output alignment, read_number=%ld, read_name='%s'\n", read_num + 1, bam_get_qname(alns[i]));
+                exit(1);
+            }
+            show_progress(++read_num);
+        }
+    }
+
+    // Close files
+    if (fastq_reader_close(r1) < 0 || fastq_reader_close(r2) < 0 || fastq_reader_close(ri1) < 0 || fastq_reader_close(ri2) < 0) {
+        fprintf(stderr, "Error reading FASTQ files\n");
+        exit(1);
+    }
+
+    if (hts_close(out) < 0) {
+        fprintf(stderr, "Error closing \"%s\"\n", fileout);
+        exit(1);
+    }
+
+    fprintf(stderr, "\nFinished: %ld reads processed\n", read_num);
+
+    // Free memory
+    for (int i = 0; i < 2 * FASTQ_BATCH_SIZE; i++) bam_destroy1(alns[i]);
+    free(alns);
+    ks_free(&umi);
+    sam_hdr_destroy(header);
+    if (tp.pool) hts_tpool_destroy(tp.pool);
+
+    return 0;
+}
@@ -0,0 +1,34 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "filter.h"
+
+/*
+ * Initialize filter. Flags are either a number or a comma separated list of
+ * flag names (e.g. 'SECONDARY,QCFAIL'), as in samtools. Empty / NULL arguments disable each check
+ * Returns -1 on error
+ */
+int read_filter_init(read_filter_t *f, const char *exclude_flags, int min_mapq, const char *expr) {
+    memset(f, 0, sizeof(read_filter_t));
+    f->min_mapq = min_mapq;
+
+    if (exclude_flags && *exclude_flags) {
+        int flags = bam_str2flag(exclude_flags);
+        if (flags < 0 || flags > 0xffff) {
+            fprintf(stderr, "Error: Invalid flags '%s'\n", exclude_flags);
+            return -1;
+        }
+        f->exclude_flags = flags;
+    }
+
+    if (expr && *expr && !(f->expr = hts_filter_init(expr))) {
+        fprintf(stderr, "Error: Could not parse filter expression '%s'\n", expr);
+        return -1;
+    }
+    return 0;
+}
+
+void read_filter_destroy(read_filter_t *f) {
+    if (f->expr) hts_filter_free(f->expr);
+    f->expr = NULL;
+}
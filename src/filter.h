@@ -0,0 +1,42 @@
+#ifndef UMI_RX_FILTER_H
+#define UMI_RX_FILTER_H
+
+#include <stdint.h>
+
+#include "htslib/hts.h"
+#include "htslib/hts_expr.h"
+#include "htslib/sam.h"
+
+/*
+ * Drop records before any tag work, so they never reach the compressor.
+ * Flag and mapping quality checks are a fast path, an htslib filter
+ * expression (compiled once) is evaluated only on records passing them.
+ */
+typedef struct read_filter_t {
+    uint16_t exclude_flags;     // Drop records having any of these flags
+    int min_mapq;               // Drop records with lower mapping quality
+    hts_filter_t *expr;         // Drop records not matching this expression
+    long count_filtered;        // Number of records dropped
+} read_filter_t;
+
+int read_filter_init(read_filter_t *f, const char *exclude_flags, int min_mapq, const char *expr);
+void read_filter_destroy(read_filter_t *f);
+
+// Is any filter enabled?
+static inline int read_filter_active(const read_filter_t *f) {
+    return f->exclude_flags || f->min_mapq > 0 || f->expr;
+}
+
+// Returns 1 if the record passes the filter, 0 if it should be dropped, -1 on error
+static inline int read_filter_pass(read_filter_t *f, const sam_hdr_t *h, const bam1_t *b) {
+    int drop = ((b->core.flag & f->exclude_flags) != 0) | (b->core.qual < f->min_mapq);
+    if (!drop && f->expr) {
+        int ret = sam_passes_filter(h, b, f->expr);
+        if (ret < 0) return -1;
+        drop = !ret;
+    }
+    f->count_filtered += drop;
+    return !drop;
+}
+
+#endif
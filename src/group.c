@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "group.h"
+#include "mem.h"
+
+void group_init(bam_group_t *g) {
+    memset(g, 0, sizeof(bam_group_t));
+}
+
+void group_destroy(bam_group_t *g) {
+    for (int i = 0; i < g->m; i++) bam_destroy1(g->recs[i]);
+    free(g->recs);
+    mem_update(MEM_GROUPS, &g->mem, 0);
+    memset(g, 0, sizeof(bam_group_t));
+}
+
+// Make room for one more record in the group
+static int group_grow(bam_group_t *g) {
+    if (g->n < g->m) return 0;
+    int m = g->m ? 2 * g->m : 4;
+    bam1_t **recs = realloc(g->recs, m * sizeof(bam1_t *));
+    if (!recs) return -1;
+    g->recs = recs;
+    for (int i = g->m; i < m; i++) {
+        if (!(g->recs[i] = bam_init1())) return -1;
+        g->m++;
+    }
+    return 0;
+}
+
+void group_reader_init(group_reader_t *r, htsFile *fp, sam_hdr_t *header) {
+    memset(r, 0, sizeof(group_reader_t));
+    r->fp = fp;
+    r->header = header;
+    r->next = bam_init1();
+}
+
+void group_reader_destroy(group_reader_t *r) {
+    bam_destroy1(r->next);
+    r->next = NULL;
+}
+
+/*
+ * Read the next group of records with the same name.
+ * Returns the number of records in the group, 0 on EOF, -1 on error
+ */
+int group_read(group_reader_t *r, bam_group_t *g) {
+    g->n = 0;
+
+    // First record in the group
+    if (!r->has_next) {
+        int ret = sam_read1(r->fp, r->header, r->next);
+        if (ret < -1) return -1;
+        if (ret < 0) return 0;
+        r->read_num++;
+    }
+    r->has_next = 0;
+
+    for (;;) {
+        // Swap pending record into the group (no copy)
+        if (group_grow(g) < 0) return -1;
+        bam1_t *tmp = g->recs[g->n];
+        g->recs[g->n++] = r->next;
+        r->next = tmp;
+
+        // Read next record, stop when the name changes
+        int ret = sam_read1(r->fp, r->header, r->next);
+        if (ret < -1) return -1;
+        if (ret < 0) break;
+        r->read_num++;
+        if (strcmp(bam_get_qname(r->next), bam_get_qname(g->recs[0])) != 0) {
+            r->has_next = 1;
+            break;
+        }
+    }
+
+    // Account capacity: records are reused, it only grows with the largest group
+    int64_t bytes = g->m * (int64_t) sizeof(bam1_t *);
+    for (int i = 0; i < g->m; i++) bytes += sizeof(bam1_t) + g->recs[i]->m_data;
+    mem_update(MEM_GROUPS, &g->mem, bytes);
+    return g->n;
+}
@@ -0,0 +1,33 @@
+#ifndef UMI_RX_GROUP_H
+#define UMI_RX_GROUP_H
+
+#include "htslib/sam.h"
+
+/*
+ * Group of consecutive records having the same read name.
+ * Records are reused between groups, so there are no allocations once
+ * the largest group has been seen
+ */
+typedef struct bam_group_t {
+    bam1_t **recs;
+    int n, m;       // Number of records in the group / allocated
+    int64_t mem;    // Bytes accounted (MEM_GROUPS)
+} bam_group_t;
+
+// Read groups of records from a name grouped (or name sorted) input
+typedef struct group_reader_t {
+    htsFile *fp;
+    sam_hdr_t *header;
+    bam1_t *next;   // First record of the next group
+    int has_next;
+    long read_num;  // Number of records read
+} group_reader_t;
+
+void group_init(bam_group_t *g);
+void group_destroy(bam_group_t *g);
+
+void group_reader_init(group_reader_t *r, htsFile *fp, sam_hdr_t *header);
+void group_reader_destroy(group_reader_t *r);
+int group_read(group_reader_t *r, bam_group_t *g);
+
+#endif
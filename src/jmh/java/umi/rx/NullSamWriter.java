@@ -0,0 +1,44 @@
+package umi.rx;
+
+import htsjdk.samtools.SAMFileHeader;
+import htsjdk.samtools.SAMFileWriter;
+import htsjdk.samtools.SAMRecord;
+import htsjdk.samtools.util.ProgressLoggerInterface;
+
+/**
+ * Writer that discards records (benchmarks measure tagging, not BAM encoding)
+ *
+ * @author pcingola
+ */
+public class NullSamWriter implements SAMFileWriter {
+
+	SAMFileHeader header;
+	long count;
+
+	public NullSamWriter(SAMFileHeader header) {
+		this.header = header;
+	}
+
+	@Override
+	public void addAlignment(SAMRecord sr) {
+		count++;
+	}
+
+	@Override
+	public void close() {
+	}
+
+	public long getCount() {
+		return count;
+	}
+
+	@Override
+	public SAMFileHeader getFileHeader() {
+		return header;
+	}
+
+	@Override
+	public void setProgressLogger(ProgressLoggerInterface progressLogger) {
+	}
+
+}
@@ -0,0 +1,113 @@
+package umi.rx;
+
+import java.util.List;
+import java.util.concurrent.TimeUnit;
+
+import org.openjdk.jmh.annotations.Benchmark;
+import org.openjdk.jmh.annotations.BenchmarkMode;
+import org.openjdk.jmh.annotations.Fork;
+import org.openjdk.jmh.annotations.Measurement;
+import org.openjdk.jmh.annotations.Mode;
+import org.openjdk.jmh.annotations.OutputTimeUnit;
+import org.openjdk.jmh.annotations.Param;
+import org.openjdk.jmh.annotations.Scope;
+import org.openjdk.jmh.annotations.Setup;
+import org.openjdk.jmh.annotations.State;
+import org.openjdk.jmh.annotations.Warmup;
+import org.openjdk.jmh.infra.Blackhole;
+
+import htsjdk.samtools.SAMFileHeader;
+import htsjdk.samtools.SAMRecord;
+
+/**
+ * RX / MC extraction: string based (read name substring, 'getCigarString()')
+ * vs raw record bytes with cached strings
+ *
+ * Each operation decodes a batch of records (as reading a BAM file does) and
+ * tags it, run with '-prof gc' to see the allocation rate:
+ *
+ * 		java -jar target/benchmarks.jar RxBenchmark -prof gc
+ *
+ * @author pcingola
+ */
+@State(Scope.Thread)
+@BenchmarkMode(Mode.Throughput)
+@OutputTimeUnit(TimeUnit.SECONDS)
+@Warmup(iterations = 3, time = 2)
+@Measurement(iterations = 5, time = 2)
+@Fork(1)
+public class RxBenchmark {
+
+	@Param({ "1000" })
+	int numPairs;
+
+	@Param({ "1000" })
+	int numUmis;
+
+	SAMFileHeader header;
+	byte[] data;
+	UmiRx umiRx;
+
+	@Setup
+	public void setup() {
+		SyntheticBam synth = new SyntheticBam(numUmis, 42);
+		header = synth.getHeader();
+		data = SyntheticBam.encode(header, synth.pairs(numPairs));
+		umiRx = new UmiRx("-", "-");
+		umiRx.setCalcRx(true);
+		umiRx.setCalcMc(true);
+	}
+
+	/**
+	 * Cigar strings from raw record bytes
+	 */
+	@Benchmark
+	public void cigarRaw(Blackhole bh) {
+		for (SAMRecord sr : SyntheticBam.decode(header, data))
+			bh.consume(umiRx.cigarString(sr));
+	}
+
+	/**
+	 * Cigar strings using 'getCigarString()'
+	 */
+	@Benchmark
+	public void cigarString(Blackhole bh) {
+		for (SAMRecord sr : SyntheticBam.decode(header, data))
+			bh.consume(sr.getCigarString());
+	}
+
+	/**
+	 * Decoding only (baseline for the other benchmarks)
+	 */
+	@Benchmark
+	public void decode(Blackhole bh) {
+		List<SAMRecord> srs = SyntheticBam.decode(header, data);
+		bh.consume(srs);
+	}
+
+	/**
+	 * Add RX tag using raw record bytes
+	 */
+	@Benchmark
+	public void rxRaw(Blackhole bh) {
+		for (SAMRecord sr : SyntheticBam.decode(header, data)) {
+			umiRx.addRx(sr);
+			bh.consume(sr);
+		}
+	}
+
+	/**
+	 * Add RX tag as the original code did: read name, 'lastIndexOf' and 'substring'
+	 */
+	@Benchmark
+	public void rxString(Blackhole bh) {
+		for (SAMRecord sr : SyntheticBam.decode(header, data)) {
+			if (sr.getAttribute(UmiRx.RX) == null) {
+				String readName = sr.getReadName();
+				sr.setAttribute(UmiRx.RX, readName.substring(readName.lastIndexOf(':') + 1));
+			}
+			bh.consume(sr);
+		}
+	}
+
+}
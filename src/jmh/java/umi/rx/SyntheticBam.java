@@ -0,0 +1,193 @@
+package umi.rx;
+
+import java.io.ByteArrayInputStream;
+import java.io.ByteArrayOutputStream;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.Random;
+
+import htsjdk.samtools.BAMRecordCodec;
+import htsjdk.samtools.SAMFileHeader;
+import htsjdk.samtools.SAMFileWriter;
+import htsjdk.samtools.SAMFileWriterFactory;
+import htsjdk.samtools.SAMRecord;
+import htsjdk.samtools.SAMSequenceRecord;
+
+/**
+ * Synthetic read name grouped records for benchmarks
+ *
+ * Records are encoded as BAM (without BGZF compression), so each benchmark
+ * iteration decodes fresh 'BAMRecord's, exactly as when reading a BAM file.
+ *
+ * @author pcingola
+ */
+public class SyntheticBam {
+
+	public static final int READ_LENGTH = 150;
+	public static final String[] CIGARS = { "150M", "148M2S", "2S148M", "75M1I74M", "70M2D80M", "100M50S", "50S100M" };
+	public static final String BASES = "ACGT";
+
+	final SAMFileHeader header;
+	final Random random;
+	final String[] umis;
+	final String namePrefix;
+	int nameNum;
+
+	public SyntheticBam(int numUmis, long seed) {
+		this(numUmis, false, seed);
+	}
+
+	/**
+	 * @param numUmis : Number of distinct UMIs
+	 * @param longNames : Use long read names (extra fields before the UMI)
+	 */
+	public SyntheticBam(int numUmis, boolean longNames, long seed) {
+		random = new Random(seed);
+		header = new SAMFileHeader();
+		header.setSortOrder(SAMFileHeader.SortOrder.unsorted);
+		header.setGroupOrder(SAMFileHeader.GroupOrder.query);
+		header.addSequence(new SAMSequenceRecord("chr1", 248956422));
+		header.addSequence(new SAMSequenceRecord("chr2", 242193529));
+
+		umis = new String[numUmis];
+		for (int i = 0; i < numUmis; i++)
+			umis[i] = randomBases(8) + "-" + randomBases(8);
+
+		namePrefix = longNames ? "A00324:79:HJ5CMDSXX:2:1101:RUN_20200101_LONG_FLOWCELL_DESCRIPTION:SAMPLE_0123456789_LIBRARY_0123456789:" : "A00324:79:HJ5CMDSXX:2:1101:";
+	}
+
+	/**
+	 * Write records to an in-memory BAM file
+	 */
+	public static byte[] bam(SAMFileHeader header, List<SAMRecord> srs) {
+		ByteArrayOutputStream out = new ByteArrayOutputStream();
+		SAMFileWriter writer = new SAMFileWriterFactory().makeBAMWriter(header, true, out);
+		for (SAMRecord sr : srs)
+			writer.addAlignment(sr);
+		writer.close();
+		return out.toByteArray();
+	}
+
+	/**
+	 * Decode BAM encoded records
+	 */
+	public static List<SAMRecord> decode(SAMFileHeader header, byte[] data) {
+		List<SAMRecord> srs = new ArrayList<>();
+		BAMRecordCodec codec = new BAMRecordCodec(header);
+		codec.setInputStream(new ByteArrayInputStream(data));
+		SAMRecord sr;
+		while ((sr = codec.decode()) != null)
+			srs.add(sr);
+		return srs;
+	}
+
+	/**
+	 * Encode records as BAM (uncompressed)
+	 */
+	public static byte[] encode(SAMFileHeader header, List<SAMRecord> srs) {
+		ByteArrayOutputStream out = new ByteArrayOutputStream();
+		BAMRecordCodec codec = new BAMRecordCodec(header);
+		codec.setOutputStream(out);
+		for (SAMRecord sr : srs)
+			codec.encode(sr);
+		return out.toByteArray();
+	}
+
+	/**
+	 * Split a list of records into read name groups
+	 */
+	public static List<List<SAMRecord>> groups(List<SAMRecord> srs) {
+		List<List<SAMRecord>> groups = new ArrayList<>();
+		List<SAMRecord> group = null;
+		String readNamePrev = null;
+		for (SAMRecord sr : srs) {
+			if (!sr.getReadName().equals(readNamePrev)) {
+				group = new ArrayList<>();
+				groups.add(group);
+			}
+			group.add(sr);
+			readNamePrev = sr.getReadName();
+		}
+		return groups;
+	}
+
+	public SAMFileHeader getHeader() {
+		return header;
+	}
+
+	/**
+	 * Next read name: 'prefix:x:y:UMI'
+	 */
+	String nextName() {
+		nameNum++;
+		return namePrefix + (nameNum % 30000) + ":" + nameNum + ":" + umis[random.nextInt(umis.length)];
+	}
+
+	/**
+	 * Read pairs: two records per read name
+	 */
+	public List<SAMRecord> pairs(int numPairs) {
+		List<SAMRecord> srs = new ArrayList<>();
+		for (int i = 0; i < numPairs; i++) {
+			String name = nextName();
+			int pos = 1 + random.nextInt(1000000);
+			int matePos = pos + random.nextInt(500);
+			srs.add(record(name, true, false, pos, matePos));
+			srs.add(record(name, false, false, matePos, pos));
+		}
+		return srs;
+	}
+
+	String randomBases(int len) {
+		StringBuilder sb = new StringBuilder();
+		for (int i = 0; i < len; i++)
+			sb.append(BASES.charAt(random.nextInt(BASES.length())));
+		return sb.toString();
+	}
+
+	SAMRecord record(String name, boolean first, boolean supplementary, int pos, int matePos) {
+		SAMRecord sr = new SAMRecord(header);
+		sr.setReadName(name);
+		sr.setReadPairedFlag(true);
+		sr.setFirstOfPairFlag(first);
+		sr.setSecondOfPairFlag(!first);
+		sr.setSupplementaryAlignmentFlag(supplementary);
+		sr.setReferenceIndex(0);
+		sr.setAlignmentStart(pos);
+		sr.setMateReferenceIndex(0);
+		sr.setMateAlignmentStart(matePos);
+		sr.setMappingQuality(random.nextInt(61));
+		sr.setCigarString(CIGARS[random.nextInt(CIGARS.length)]);
+		sr.setInferredInsertSize(first ? matePos - pos + READ_LENGTH : pos - matePos - READ_LENGTH);
+
+		byte[] bases = new byte[READ_LENGTH];
+		byte[] quals = new byte[READ_LENGTH];
+		for (int i = 0; i < READ_LENGTH; i++) {
+			bases[i] = (byte) BASES.charAt(random.nextInt(BASES.length()));
+			quals[i] = (byte) (2 + random.nextInt(40));
+		}
+		sr.setReadBases(bases);
+		sr.setBaseQualities(quals);
+		sr.setAttribute("NM", random.nextInt(5));
+		sr.setAttribute("AS", READ_LENGTH - random.nextInt(20));
+		return sr;
+	}
+
+	/**
+	 * Supplementary heavy groups: a pair plus 'numSupplementary' supplementary alignments per read name
+	 */
+	public List<SAMRecord> supplementaryGroups(int numGroups, int numSupplementary) {
+		List<SAMRecord> srs = new ArrayList<>();
+		for (int i = 0; i < numGroups; i++) {
+			String name = nextName();
+			int pos = 1 + random.nextInt(1000000);
+			int matePos = pos + random.nextInt(500);
+			srs.add(record(name, true, false, pos, matePos));
+			srs.add(record(name, false, false, matePos, pos));
+			for (int j = 0; j < numSupplementary; j++)
+				srs.add(record(name, j % 2 == 0, true, 1 + random.nextInt(1000000), j % 2 == 0 ? matePos : pos));
+		}
+		return srs;
+	}
+
+}
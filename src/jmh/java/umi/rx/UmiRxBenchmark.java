@@ -0,0 +1,176 @@
+package umi.rx;
+
+import java.io.ByteArrayInputStream;
+import java.io.IOException;
+import java.io.OutputStream;
+import java.io.PrintStream;
+import java.util.List;
+import java.util.concurrent.TimeUnit;
+
+import org.openjdk.jmh.annotations.Benchmark;
+import org.openjdk.jmh.annotations.BenchmarkMode;
+import org.openjdk.jmh.annotations.Fork;
+import org.openjdk.jmh.annotations.Measurement;
+import org.openjdk.jmh.annotations.Mode;
+import org.openjdk.jmh.annotations.OutputTimeUnit;
+import org.openjdk.jmh.annotations.Param;
+import org.openjdk.jmh.annotations.Scope;
+import org.openjdk.jmh.annotations.Setup;
+import org.openjdk.jmh.annotations.State;
+import org.openjdk.jmh.annotations.TearDown;
+import org.openjdk.jmh.annotations.Warmup;
+import org.openjdk.jmh.infra.Blackhole;
+
+import htsjdk.samtools.SAMFileHeader;
+import htsjdk.samtools.SAMRecord;
+import htsjdk.samtools.SamInputResource;
+import htsjdk.samtools.SamReader;
+import htsjdk.samtools.SamReaderFactory;
+import htsjdk.samtools.ValidationStringency;
+
+/**
+ * Throughput of UmiRx hot methods on synthetic batches:
+ * read pairs, supplementary heavy name groups and short / long read names.
+ *
+ * One operation processes a whole batch ('numGroups' read names), decoding it first
+ * because tagging modifies the records ('decode*' benchmarks are the baseline).
+ * Output records are discarded, so BAM encoding / compression is not measured.
+ *
+ * Run with the GC profiler to get the allocation rate per method (see 'script/bench_jmh.sh'):
+ *
+ * 		java -jar target/benchmarks.jar UmiRxBenchmark -prof gc
+ *
+ * @author pcingola
+ */
+@State(Scope.Thread)
+@BenchmarkMode(Mode.Throughput)
+@OutputTimeUnit(TimeUnit.SECONDS)
+@Warmup(iterations = 3, time = 2)
+@Measurement(iterations = 5, time = 2)
+@Fork(1)
+public class UmiRxBenchmark {
+
+	@Param({ "short", "long" })
+	String names;
+
+	@Param({ "1000" })
+	int numGroups;
+
+	@Param({ "4" })
+	int numSupplementary;
+
+	SAMFileHeader header;
+	byte[] pairs, supplementary; // BAM encoded records
+	byte[] pairsBam, supplementaryBam; // In-memory BAM files
+	UmiRx umiRx;
+	NullSamWriter writer;
+	PrintStream stderr;
+
+	/**
+	 * UmiRx adding RX, MC and MQ, writing to a NullSamWriter
+	 */
+	UmiRx newUmiRx() {
+		UmiRx umiRx = new UmiRx("-", "-");
+		umiRx.setCalcRx(true);
+		umiRx.setCalcMc(true);
+		umiRx.setCalcMq(true);
+		umiRx.samWriter = writer;
+		return umiRx;
+	}
+
+	SamReader reader(byte[] bam) {
+		return SamReaderFactory.make().validationStringency(ValidationStringency.LENIENT).open(SamInputResource.of(new ByteArrayInputStream(bam)));
+	}
+
+	@Setup
+	public void setup() {
+		SyntheticBam synth = new SyntheticBam(1000, names.equals("long"), 42);
+		header = synth.getHeader();
+
+		List<SAMRecord> srsPairs = synth.pairs(numGroups);
+		pairs = SyntheticBam.encode(header, srsPairs);
+		pairsBam = SyntheticBam.bam(header, srsPairs);
+
+		List<SAMRecord> srsSup = synth.supplementaryGroups(numGroups, numSupplementary);
+		supplementary = SyntheticBam.encode(header, srsSup);
+		supplementaryBam = SyntheticBam.bam(header, srsSup);
+
+		writer = new NullSamWriter(header);
+		umiRx = newUmiRx();
+
+		// Progress messages from 'transform*' methods are discarded
+		stderr = System.err;
+		System.setErr(new PrintStream(OutputStream.nullOutputStream()));
+	}
+
+	@TearDown
+	public void tearDown() {
+		System.setErr(stderr);
+	}
+
+	/**
+	 * Run a transform method on an in-memory BAM file
+	 */
+	void transform(byte[] bam, boolean mateTags) {
+		try (SamReader samReader = reader(bam)) {
+			umiRx.samReader = samReader;
+			if (mateTags) umiRx.transformM();
+			else umiRx.transformRx();
+		} catch (IOException e) {
+			throw new RuntimeException(e);
+		}
+	}
+
+	@Benchmark
+	public void addRx(Blackhole bh) {
+		for (SAMRecord sr : SyntheticBam.decode(header, pairs)) {
+			umiRx.addRx(sr);
+			bh.consume(sr);
+		}
+	}
+
+	@Benchmark
+	public void decodePairs(Blackhole bh) {
+		bh.consume(SyntheticBam.groups(SyntheticBam.decode(header, pairs)));
+	}
+
+	@Benchmark
+	public void decodeSupplementary(Blackhole bh) {
+		bh.consume(SyntheticBam.groups(SyntheticBam.decode(header, supplementary)));
+	}
+
+	@Benchmark
+	public void process2(Blackhole bh) {
+		for (List<SAMRecord> group : SyntheticBam.groups(SyntheticBam.decode(header, pairs))) {
+			umiRx.process2(group);
+			bh.consume(group);
+		}
+	}
+
+	@Benchmark
+	public void process3orMore(Blackhole bh) {
+		for (List<SAMRecord> group : SyntheticBam.groups(SyntheticBam.decode(header, supplementary))) {
+			umiRx.process3orMore(group);
+			bh.consume(group);
+		}
+	}
+
+	@Benchmark
+	public long transformMPairs() {
+		transform(pairsBam, true);
+		return writer.getCount();
+	}
+
+	@Benchmark
+	public long transformMSupplementary() {
+		transform(supplementaryBam, true);
+		return writer.getCount();
+	}
+
+	@Benchmark
+	public long transformRx() {
+		transform(pairsBam, false);
+		return writer.getCount();
+	}
+
+}
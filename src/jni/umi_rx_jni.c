@@ -0,0 +1,46 @@
+#include <jni.h>
+#include <stdio.h>
+
+#include "engine.h"
+#include "umirx.h"
+
+/*
+ * JNI entry point for the Java version ('umi.rx.NativeUmiRx'): runs the
+ * whole file to file job in the C engine (multi-threaded htslib I/O).
+ *
+ * Flags are the UMIRX_* flags from 'umirx.h'. Returns the number of reads
+ * processed, or -1 on error (messages are shown on stderr).
+ */
+JNIEXPORT jlong JNICALL Java_umi_rx_NativeUmiRx_run(JNIEnv *env, jclass cls, jstring jin, jstring jout, jint flags, jint level, jboolean sam, jint threads) {
+    const char *filein = (*env)->GetStringUTFChars(env, jin, NULL);
+    const char *fileout = (*env)->GetStringUTFChars(env, jout, NULL);
+    if (!filein || !fileout) {
+        if (filein) (*env)->ReleaseStringUTFChars(env, jin, filein);
+        if (fileout) (*env)->ReleaseStringUTFChars(env, jout, fileout);
+        return -1;
+    }
+
+    engine_t engine;
+    engine_init(&engine);
+    mate_tags_t *mate = &engine.tagger.mate;
+    mate->calc_mc = (flags & UMIRX_MC) != 0;
+    mate->calc_mq = (flags & UMIRX_MQ) != 0;
+    mate->calc_ms = (flags & UMIRX_MS) != 0;
+    mate->fixmate = (flags & UMIRX_FIXMATE) != 0;
+
+    // Output mode
+    char modew[8] = "wb";
+    if (sam) snprintf(modew, sizeof(modew), "w");
+    else if (level >= 0) snprintf(modew, sizeof(modew), "wb%d", level > 9 ? 9 : (int) level);
+
+    jlong ret = -1;
+    if (engine_run_files(&engine, filein, fileout, modew, threads, NULL, 0) == 0) {
+        fprintf(stderr, "\nFinished: %ld reads processed\tcountMc: %ld\tcountMq: %ld\n", engine.read_num, mate->count_mc, mate->count_mq);
+        ret = engine.read_num;
+    }
+
+    engine_destroy(&engine);
+    (*env)->ReleaseStringUTFChars(env, jin, filein);
+    (*env)->ReleaseStringUTFChars(env, jout, fileout);
+    return ret;
+}
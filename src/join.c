@@ -0,0 +1,255 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "htslib/khash.h"
+#include "htslib/sam.h"
+#include "htslib/thread_pool.h"
+
+#include "fastq.h"
+#include "umi_rx.h"
+
+#define DEFAULT_WINDOW 1000000
+
+KHASH_MAP_INIT_STR(umi, int)
+
+/*
+ * Window of the latest UMI FASTQ records: a ring buffer of (read name, UMI)
+ * indexed by read name. When the window is full the oldest record is evicted
+ */
+typedef struct umi_window_t {
+    fastq_reader_t *reader;
+    fastq_batch_t *batch;       // Current FASTQ batch
+    int batch_idx;              // Next record in current batch
+    khash_t(umi) *hash;         // Read name -> slot
+    kstring_t *names, *umis;
+    int size, head, n;
+} umi_window_t;
+
+static void usage_join(FILE *fp) {
+    fprintf(fp,
+            "Usage: umi_rx join [options] input.bam umi.fastq.gz output.bam\n"
+            "\n"
+            "Add 'RX' tag to reads in 'input.bam' using UMIs from a FASTQ file (e.g. I2),\n"
+            "joining on read name. The input BAM must be in FASTQ (i.e. aligner input) order,\n"
+            "or grouped by read name; reads reordered within the window are found.\n"
+            "\n"
+            "Options:\n"
+            "  -w, --window INT    Max. number of UMI records kept in memory. Default: %d\n"
+            "  -l, --level INT     Compression level for output BAM\n"
+            "  -@, --threads INT   Number of threads for (de)compression. Default: 0\n", DEFAULT_WINDOW);
+}
+
+// Returns NULL on error
+static umi_window_t *umi_window_init(fastq_reader_t *reader, int size) {
+    umi_window_t *w = calloc(1, sizeof(umi_window_t));
+    if (!w) {
+        fprintf(stderr, "Error allocating UMI window\n");
+        return NULL;
+    }
+    w->reader = reader;
+    w->hash = kh_init(umi);
+    w->names = calloc(size, sizeof(kstring_t));
+    w->umis = calloc(size, sizeof(kstring_t));
+    if (!w->hash || !w->names || !w->umis) {
+        fprintf(stderr, "Error allocating UMI window of %d records\n", size);
+        if (w->hash) kh_destroy(umi, w->hash);
+        free(w->names);
+        free(w->umis);
+        free(w);
+        return NULL;
+    }
+    w->size = size;
+    return w;
+}
+
+static void umi_window_destroy(umi_window_t *w) {
+    if (w->batch) fastq_reader_release(w->reader, w->batch);
+    for (int i = 0; i < w->size; i++) {
+        ks_free(&w->names[i]);
+        ks_free(&w->umis[i]);
+    }
+    free(w->names);
+    free(w->umis);
+    kh_destroy(umi, w->hash);
+    free(w);
+}
+
+// Add the next FASTQ record to the window. Returns the slot, or -1 if there are no more records
+static int umi_window_add(umi_window_t *w) {
+    // Next FASTQ record
+    if (!w->batch || w->batch_idx >= w->batch->n) {
+        if (w->batch) fastq_reader_release(w->reader, w->batch);
+        w->batch_idx = 0;
+        if (!(w->batch = fastq_reader_next(w->reader))) return -1;
+    }
+    fastq_batch_t *b = w->batch;
+    int i = w->batch_idx++;
+
+    // Window full? Evict oldest record
+    if (w->n == w->size) {
+        khint_t k = kh_get(umi, w->hash, w->names[w->head].s);
+        if (k != kh_end(w->hash) && kh_val(w->hash, k) == w->head) kh_del(umi, w->hash, k);
+        w->head = (w->head + 1) % w->size;
+        w->n--;
+    }
+
+    // Add record
+    int slot = (w->head + w->n) % w->size;
+    w->n++;
+    w->names[slot].l = w->umis[slot].l = 0;
+    kputsn(fastq_name(b, i), b->rec[i].l_name, &w->names[slot]);
+    kputsn(fastq_seq(b, i), b->rec[i].l_seq, &w->umis[slot]);
+
+    int ret;
+    khint_t k = kh_put(umi, w->hash, w->names[slot].s, &ret);
+    if (ret == 0) kh_key(w->hash, k) = w->names[slot].s; // Repeated read name, use latest record
+    kh_val(w->hash, k) = slot;
+    return slot;
+}
+
+// Find UMI for a read name, reading ahead from the FASTQ file if needed
+static kstring_t *umi_window_find(umi_window_t *w, const char *read_name) {
+    khint_t k = kh_get(umi, w->hash, read_name);
+    if (k != kh_end(w->hash)) return &w->umis[kh_val(w->hash, k)];
+
+    int slot;
+    while ((slot = umi_window_add(w)) >= 0) {
+        if (strcmp(w->names[slot].s, read_name) == 0) return &w->umis[slot];
+    }
+    return NULL;
+}
+
+int main_join(int argc, char **argv) {
+    static const struct option lopts[] = {
+        {"window", required_argument, NULL, 'w'},
+        {"level", required_argument, NULL, 'l'},
+        {"threads", required_argument, NULL, '@'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int window = DEFAULT_WINDOW, level = -1, threads = 0, c;
+    while ((c = getopt_long(argc, argv, "w:l:@:h", lopts, NULL)) >= 0) {
+        switch (c) {
+        case 'w': window = atoi(optarg); break;
+        case 'l': level = atoi(optarg); break;
+        case '@': threads = atoi(optarg); break;
+        case 'h': usage_join(stdout); return 0;
+        default: usage_join(stderr); return 1;
+        }
+    }
+    if (argc - optind != 3 || window <= 0) {
+        usage_join(stderr);
+        return 1;
+    }
+
+    char *filein = argv[optind], *fileumi = argv[optind + 1], *fileout = argv[optind + 2];
+
+    // Thread pool shared by all inputs and the output
+    htsThreadPool tp = {NULL, 0};
+    if (threads > 0 && !(tp.pool = hts_tpool_init(threads))) {
+        fprintf(stderr, "Error creating thread pool\n");
+        exit(1);
+    }
+
+    // Open UMI FASTQ, it is decompressed and parsed in its own thread
+    fastq_reader_t *reader = fastq_reader_open(fileumi, tp.pool);
+    if (!reader) exit(1);
+
+    // Open in.bam
+    htsFile *in = hts_open(filein, "r");
+    if (!in) {
+        fprintf(stderr, "Error opening \"%s\"\n", filein);
+        exit(1);
+    }
+
+    // Open out.bam
+    char modew[8] = "wb";
+    if (level >= 0) snprintf(modew, sizeof(modew), "wb%d", level > 9 ? 9 : level);
+    htsFile *out = hts_open(fileout, modew);
+    if (!out) {
+        fprintf(stderr, "Error opening \"%s\"\n", fileout);
+        exit(1);
+    }
+
+    if (tp.pool) {
+        hts_set_thread_pool(in, &tp);
+        hts_set_thread_pool(out, &tp);
+    }
+
+    // Read header, add '@PG' line
+    sam_hdr_t *header = sam_hdr_read(in);
+    if (header == NULL) {
+        fprintf(stderr, "Couldn't read header for \"%s\"\n", filein);
+        exit(1);
+    }
+    sam_hdr_add_pg(header, "umi_rx", "VN", UMI_RX_VERSION, "CL", umi_rx_cmdline, NULL);
+
+    // Write header
+    if (sam_hdr_write(out, header) < 0) {
+        fprintf(stderr, "Error writing output header.\n");
+        exit(1);
+    }
+
+    umi_window_t *w = umi_window_init(reader, window);
+    if (!w) exit(1);
+    bam1_t *aln = bam_init1();
+    long read_num;
+    int ret;
+    for (read_num = 1; (ret = sam_read1(in, header, aln)) >= 0; read_num++) {
+        char *read_name = bam_get_qname(aln);
+
+        kstring_t *umi = umi_window_find(w, read_name);
+        if (!umi) {
+            if (fastq_reader_error(reader)) exit(1);
+            fprintf(stderr, "Error: Could not find UMI for read in '%s' (within a window of %d reads), read_number=%ld, read_name='%s'\n", fileumi, window, read_num, read_name);
+            exit(1);
+        }
+
+        show_progress(read_num);
+
+        // Add UMI to 'RX' tag
+        if (bam_aux_update_str(aln, "RX", umi->l + 1, umi->s) < 0) {
+            fprintf(stderr, "Error updating RX tag");
+            exit(1);
+        }
+
+        // Write alignment to output
+        if (sam_write1(out, header, aln) < 0) {
+            fprintf(stderr, "Error writing output alignment, read_number=%ld, read_name='%s'\n", read_num, read_name);
+            exit(1);
+        }
+    }
+    if (ret < -1) {
+        fprintf(stderr, "Error reading \"%s\", read_number=%ld\n", filein, read_num);
+        exit(1);
+    }
+
+    fprintf(stderr, "\nFinished: %ld reads processed\n", read_num - 1);
+
+    // Close files
+    umi_window_destroy(w);
+    if (fastq_reader_close(reader) < 0) {
+        fprintf(stderr, "Error reading \"%s\"\n", fileumi);
+        exit(1);
+    }
+
+    if (hts_close(out) < 0) {
+        fprintf(stderr, "Error closing \"%s\"\n", fileout);
+        exit(1);
+    }
+
+    if (hts_close(in) < 0) {
+        fprintf(stderr, "Error closing \"%s\"\n", filein);
+        exit(1);
+    }
+
+    // Free memory
+    bam_destroy1(aln);
+    sam_hdr_destroy(header);
+    if (tp.pool) hts_tpool_destroy(tp.pool);
+
+    return 0;
+}
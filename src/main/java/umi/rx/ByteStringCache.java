@@ -0,0 +1,78 @@
+package umi.rx;
+
+import java.util.Arrays;
+
+/**
+ * Cache of strings keyed by byte ranges (e.g. UMIs from raw read names, raw CIGARs)
+ *
+ * Lookups hash the bytes in place, so a hit does not allocate.
+ * The cache is direct mapped: a new entry replaces the one having the same slot,
+ * so memory is bounded regardless of the number of distinct keys.
+ *
+ * @author pcingola
+ */
+public class ByteStringCache {
+
+	public static final int DEFAULT_SIZE = 1 << 16;
+
+	final int mask;
+	final byte[][] keys;
+	final String[] values;
+	long hits, misses;
+
+	public ByteStringCache() {
+		this(DEFAULT_SIZE);
+	}
+
+	/**
+	 * Size is rounded up to a power of two
+	 */
+	public ByteStringCache(int size) {
+		int n = Integer.highestOneBit(Math.max(2, size - 1)) << 1;
+		mask = n - 1;
+		keys = new byte[n][];
+		values = new String[n];
+	}
+
+	/**
+	 * FNV-1a hash of a byte range
+	 */
+	static int hash(byte[] buf, int start, int end) {
+		int h = 0x811c9dc5;
+		for (int i = start; i < end; i++)
+			h = (h ^ buf[i]) * 0x01000193;
+		return h ^ (h >>> 16);
+	}
+
+	/**
+	 * Get the string for bytes 'buf[start, end)', null if not in the cache
+	 */
+	public String get(byte[] buf, int start, int end) {
+		int slot = hash(buf, start, end) & mask;
+		byte[] key = keys[slot];
+		if (key != null && Arrays.equals(key, 0, key.length, buf, start, end)) {
+			hits++;
+			return values[slot];
+		}
+		misses++;
+		return null;
+	}
+
+	public long getHits() {
+		return hits;
+	}
+
+	public long getMisses() {
+		return misses;
+	}
+
+	/**
+	 * Add the string for bytes 'buf[start, end)'
+	 */
+	public void put(byte[] buf, int start, int end, String value) {
+		int slot = hash(buf, start, end) & mask;
+		keys[slot] = Arrays.copyOfRange(buf, start, end);
+		values[slot] = value;
+	}
+
+}
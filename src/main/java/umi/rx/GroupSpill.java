@@ -0,0 +1,125 @@
+package umi.rx;
+
+import java.io.BufferedInputStream;
+import java.io.BufferedOutputStream;
+import java.io.Closeable;
+import java.io.File;
+import java.io.FileInputStream;
+import java.io.FileOutputStream;
+import java.io.IOException;
+import java.io.InputStream;
+import java.io.OutputStream;
+import java.util.Iterator;
+import java.util.NoSuchElementException;
+
+import htsjdk.samtools.BAMRecordCodec;
+import htsjdk.samtools.SAMFileHeader;
+import htsjdk.samtools.SAMRecord;
+
+/**
+ * A read name group too large to keep in memory (e.g. repeated default read
+ * names or thousands of supplementary alignments)
+ *
+ * Records are appended to a temporary file (BAM encoded, uncompressed) while
+ * the mate summary is updated incrementally. Iterating replays the records,
+ * adding tags as they are decoded, and deletes the file at the end.
+ *
+ * @author pcingola
+ */
+public class GroupSpill implements Closeable, Iterable<SAMRecord> {
+
+	public static final int BUFFER_SIZE = 1024 * 1024;
+
+	final UmiRx umiRx;
+	final BAMRecordCodec codec;
+	final UmiRx.MateSummary summary;
+	File file;
+	InputStream in;
+	OutputStream out;
+	long size;
+
+	public GroupSpill(UmiRx umiRx, SAMFileHeader header) {
+		this.umiRx = umiRx;
+		codec = new BAMRecordCodec(header);
+		summary = new UmiRx.MateSummary();
+		try {
+			file = File.createTempFile("umirx_group_", ".bam");
+			file.deleteOnExit();
+			out = new BufferedOutputStream(new FileOutputStream(file), BUFFER_SIZE);
+		} catch (IOException e) {
+			throw new RuntimeException(e);
+		}
+		codec.setOutputStream(out);
+	}
+
+	/**
+	 * Add a record: update mate summary and write it to the temporary file
+	 */
+	public void add(SAMRecord sr) {
+		umiRx.summarize(summary, sr);
+		codec.encode(sr);
+		size++;
+	}
+
+	/**
+	 * Delete temporary file
+	 */
+	@Override
+	public void close() {
+		try {
+			if (out != null) out.close();
+			if (in != null) in.close();
+			out = null;
+			in = null;
+		} catch (IOException e) {
+			throw new RuntimeException(e);
+		} finally {
+			file.delete();
+		}
+	}
+
+	/**
+	 * Replay records, adding RX / MC / MQ tags.
+	 * Can only be iterated once, the temporary file is deleted after the last record
+	 */
+	@Override
+	public Iterator<SAMRecord> iterator() {
+		try {
+			out.close();
+			out = null;
+			in = new BufferedInputStream(new FileInputStream(file), BUFFER_SIZE);
+			codec.setInputStream(in);
+		} catch (IOException e) {
+			throw new RuntimeException(e);
+		}
+
+		return new Iterator<SAMRecord>() {
+			SAMRecord next = decode();
+
+			SAMRecord decode() {
+				SAMRecord sr = codec.decode();
+				if (sr == null) close();
+				return sr;
+			}
+
+			@Override
+			public boolean hasNext() {
+				return next != null;
+			}
+
+			@Override
+			public SAMRecord next() {
+				if (next == null) throw new NoSuchElementException();
+				SAMRecord sr = next;
+				next = decode();
+				umiRx.tagMates(summary, sr);
+				return sr;
+			}
+		};
+	}
+
+	public long size() {
+		return size;
+	}
+
+}
@@ -0,0 +1,48 @@
+package umi.rx;
+
+/**
+ * Native backend: runs the whole file to file job in the C engine
+ * (htslib, multi-threaded BGZF) through JNI ('src/jni/umi_rx_jni.c')
+ *
+ * The library is 'libumirx_jni.so' (built by 'script/make_c.sh'), loaded from
+ * the path in system property 'umirx.jni' or from 'java.library.path'.
+ * If it cannot be loaded, UmiRx uses htsjdk.
+ *
+ * @author pcingola
+ */
+public class NativeUmiRx {
+
+	// Flags, same values as UMIRX_* in 'src/umirx.h'
+	public static final int MC = 0x1;
+	public static final int MQ = 0x2;
+
+	static final boolean available = load();
+
+	/**
+	 * Is the native library available?
+	 */
+	public static boolean isAvailable() {
+		return available;
+	}
+
+	static boolean load() {
+		try {
+			String path = System.getProperty("umirx.jni");
+			if (path != null) System.load(path);
+			else System.loadLibrary("umirx_jni");
+			return true;
+		} catch (UnsatisfiedLinkError | SecurityException e) {
+			return false;
+		}
+	}
+
+	/**
+	 * Add RX tags (and MC / MQ if requested in 'flags') to 'in', write 'out' ("-" for STDIN / STDOUT)
+	 * @param level : BAM compression level (-1 for default)
+	 * @param sam : Write SAM instead of BAM
+	 * @param threads : Number of htslib threads for (de)compression
+	 * @return Number of reads processed, -1 on error
+	 */
+	public static native long run(String in, String out, int flags, int level, boolean sam, int threads);
+
+}
@@ -0,0 +1,81 @@
+package umi.rx;
+
+import java.io.IOException;
+import java.io.OutputStream;
+import java.io.StringWriter;
+
+import htsjdk.samtools.BAMRecordCodec;
+import htsjdk.samtools.SAMFileHeader;
+import htsjdk.samtools.SAMFileWriter;
+import htsjdk.samtools.SAMRecord;
+import htsjdk.samtools.SAMSequenceRecord;
+import htsjdk.samtools.SAMTextHeaderCodec;
+import htsjdk.samtools.util.BinaryCodec;
+import htsjdk.samtools.util.ProgressLoggerInterface;
+
+/**
+ * BAM writer using a ParallelBlockCompressedOutputStream: records are
+ * encoded in the calling thread, BGZF blocks are compressed in parallel
+ *
+ * @author pcingola
+ */
+public class ParallelBamWriter implements SAMFileWriter {
+
+	public static final byte[] BAM_MAGIC = "BAM\1".getBytes();
+
+	SAMFileHeader header;
+	ParallelBlockCompressedOutputStream bgzf;
+	BAMRecordCodec codec;
+	ProgressLoggerInterface progressLogger;
+
+	public ParallelBamWriter(SAMFileHeader header, OutputStream out, int compressionLevel, int threads) {
+		this.header = header;
+		bgzf = new ParallelBlockCompressedOutputStream(out, compressionLevel, threads);
+		writeHeader();
+		codec = new BAMRecordCodec(header);
+		codec.setOutputStream(bgzf);
+	}
+
+	@Override
+	public void addAlignment(SAMRecord sr) {
+		codec.encode(sr);
+		if (progressLogger != null) progressLogger.record(sr);
+	}
+
+	@Override
+	public void close() {
+		try {
+			bgzf.close();
+		} catch (IOException e) {
+			throw new RuntimeException(e);
+		}
+	}
+
+	@Override
+	public SAMFileHeader getFileHeader() {
+		return header;
+	}
+
+	@Override
+	public void setProgressLogger(ProgressLoggerInterface progressLogger) {
+		this.progressLogger = progressLogger;
+	}
+
+	/**
+	 * Write BAM header: magic, header text and reference sequences
+	 */
+	void writeHeader() {
+		StringWriter headerText = new StringWriter();
+		new SAMTextHeaderCodec().encode(headerText, header);
+
+		BinaryCodec bc = new BinaryCodec(bgzf);
+		bc.writeBytes(BAM_MAGIC);
+		bc.writeString(headerText.toString(), true, false);
+		bc.writeInt(header.getSequenceDictionary().size());
+		for (SAMSequenceRecord seq : header.getSequenceDictionary().getSequences()) {
+			bc.writeString(seq.getSequenceName(), true, true);
+			bc.writeInt(seq.getSequenceLength());
+		}
+	}
+
+}
@@ -0,0 +1,205 @@
+package umi.rx;
+
+import java.io.IOException;
+import java.io.OutputStream;
+import java.util.ArrayDeque;
+import java.util.concurrent.ConcurrentLinkedQueue;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.Future;
+import java.util.zip.CRC32;
+import java.util.zip.Deflater;
+
+import htsjdk.samtools.util.BlockCompressedStreamConstants;
+
+/**
+ * BGZF output stream that deflates blocks on a thread pool
+ *
+ * Data is split into blocks (up to BLOCK_SIZE uncompressed bytes), each block
+ * is compressed by a worker thread and blocks are written in order.
+ * The number of blocks in flight is bounded, so memory stays flat.
+ *
+ * Output is the same format as htsjdk's 'BlockCompressedOutputStream' (including
+ * the terminating empty block), but no index / virtual file pointers are supported.
+ *
+ * @author pcingola
+ */
+public class ParallelBlockCompressedOutputStream extends OutputStream {
+
+	/**
+	 * Uncompressed bytes per block. Less than 64KB so that a block
+	 * stored without compression still fits in a BGZF block
+	 */
+	public static final int BLOCK_SIZE = 0xff00;
+
+	/**
+	 * Compress one block: gzip header with BGZF extra field, deflated data, CRC32 and size
+	 */
+	class BlockCompressor {
+		final Deflater deflater;
+		final Deflater noCompressionDeflater;
+		final CRC32 crc32 = new CRC32();
+		final byte[] compressed = new byte[BlockCompressedStreamConstants.MAX_COMPRESSED_BLOCK_SIZE];
+
+		BlockCompressor() {
+			deflater = new Deflater(compressionLevel, true);
+			noCompressionDeflater = new Deflater(Deflater.NO_COMPRESSION, true);
+		}
+
+		byte[] compress(byte[] data, int len) {
+			int header = BlockCompressedStreamConstants.BLOCK_HEADER_LENGTH;
+			int maxLen = compressed.length - header - BlockCompressedStreamConstants.BLOCK_FOOTER_LENGTH;
+
+			// Deflate, if the result doesn't fit in a block use no compression
+			int clen = deflate(deflater, data, len, maxLen);
+			if (clen < 0) clen = deflate(noCompressionDeflater, data, len, maxLen);
+			if (clen < 0) throw new RuntimeException("Unable to compress block of " + len + " bytes");
+
+			crc32.reset();
+			crc32.update(data, 0, len);
+
+			// Assemble block: header, compressed data, footer
+			int totalLen = header + clen + BlockCompressedStreamConstants.BLOCK_FOOTER_LENGTH;
+			byte[] block = new byte[totalLen];
+			System.arraycopy(BlockCompressedStreamConstants.GZIP_BLOCK_PREAMBLE, 0, block, 0, BlockCompressedStreamConstants.GZIP_BLOCK_PREAMBLE.length);
+			putShort(block, BlockCompressedStreamConstants.BLOCK_LENGTH_OFFSET, totalLen - 1);
+			System.arraycopy(compressed, header, block, header, clen);
+			putInt(block, header + clen, (int) crc32.getValue());
+			putInt(block, header + clen + 4, len);
+			return block;
+		}
+
+		/**
+		 * Deflate data into 'compressed' (after the header space). Returns compressed size, -1 if it doesn't fit
+		 */
+		int deflate(Deflater d, byte[] data, int len, int maxLen) {
+			d.reset();
+			d.setInput(data, 0, len);
+			d.finish();
+			int clen = d.deflate(compressed, BlockCompressedStreamConstants.BLOCK_HEADER_LENGTH, maxLen);
+			return d.finished() ? clen : -1;
+		}
+
+		void end() {
+			deflater.end();
+			noCompressionDeflater.end();
+		}
+	}
+
+	static void putInt(byte[] buf, int pos, int value) {
+		buf[pos] = (byte) value;
+		buf[pos + 1] = (byte) (value >>> 8);
+		buf[pos + 2] = (byte) (value >>> 16);
+		buf[pos + 3] = (byte) (value >>> 24);
+	}
+
+	static void putShort(byte[] buf, int pos, int value) {
+		buf[pos] = (byte) value;
+		buf[pos + 1] = (byte) (value >>> 8);
+	}
+
+	final OutputStream out;
+	final int compressionLevel;
+	final int maxPending;
+	final ExecutorService pool;
+	final ConcurrentLinkedQueue<BlockCompressor> compressors = new ConcurrentLinkedQueue<>(); // Deflaters are reused
+	final ConcurrentLinkedQueue<byte[]> buffers = new ConcurrentLinkedQueue<>(); // Uncompressed buffers are reused
+	final ArrayDeque<Future<byte[]>> pending = new ArrayDeque<>(); // Blocks being compressed, in output order
+	byte[] buffer;
+	int bufferLen;
+	boolean closed;
+
+	public ParallelBlockCompressedOutputStream(OutputStream out, int compressionLevel, int threads) {
+		this.out = out;
+		this.compressionLevel = compressionLevel;
+		threads = Math.max(1, threads);
+		maxPending = 2 * threads;
+		pool = Executors.newFixedThreadPool(threads, r -> {
+			Thread t = new Thread(r, "bgzf-deflate");
+			t.setDaemon(true);
+			return t;
+		});
+		buffer = new byte[BLOCK_SIZE];
+	}
+
+	@Override
+	public void close() throws IOException {
+		if (closed) return;
+		flush();
+		out.write(BlockCompressedStreamConstants.EMPTY_GZIP_BLOCK);
+		out.close();
+		pool.shutdown();
+		for (BlockCompressor c : compressors)
+			c.end();
+		closed = true;
+	}
+
+	/**
+	 * Compress current buffer and wait for all blocks to be written
+	 */
+	@Override
+	public void flush() throws IOException {
+		submitBlock();
+		while (!pending.isEmpty())
+			writeNextBlock();
+		out.flush();
+	}
+
+	/**
+	 * Send the current buffer to the thread pool, block if too many blocks are in flight
+	 */
+	void submitBlock() throws IOException {
+		if (bufferLen == 0) return;
+
+		byte[] data = buffer;
+		int len = bufferLen;
+		pending.add(pool.submit(() -> {
+			BlockCompressor c = compressors.poll();
+			if (c == null) c = new BlockCompressor();
+			try {
+				return c.compress(data, len);
+			} finally {
+				compressors.add(c);
+				buffers.add(data);
+			}
+		}));
+
+		buffer = buffers.poll();
+		if (buffer == null) buffer = new byte[BLOCK_SIZE];
+		bufferLen = 0;
+
+		while (pending.size() > maxPending)
+			writeNextBlock();
+	}
+
+	@Override
+	public void write(byte[] b, int off, int len) throws IOException {
+		while (len > 0) {
+			int n = Math.min(len, BLOCK_SIZE - bufferLen);
+			System.arraycopy(b, off, buffer, bufferLen, n);
+			bufferLen += n;
+			off += n;
+			len -= n;
+			if (bufferLen == BLOCK_SIZE) submitBlock();
+		}
+	}
+
+	@Override
+	public void write(int b) throws IOException {
+		buffer[bufferLen++] = (byte) b;
+		if (bufferLen == BLOCK_SIZE) submitBlock();
+	}
+
+	/**
+	 * Wait for the oldest block and write it
+	 */
+	void writeNextBlock() throws IOException {
+		try {
+			out.write(pending.poll().get());
+		} catch (InterruptedException | ExecutionException e) {
+			throw new IOException("Error compressing block", e);
+		}
+	}
+
+}
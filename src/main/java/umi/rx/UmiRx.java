@@ -1,9 +1,23 @@
 package umi.rx;
 
+import java.io.BufferedOutputStream;
 import java.io.File;
+import java.io.FileDescriptor;
+import java.io.FileOutputStream;
 import java.io.IOException;
+import java.io.OutputStream;
+import java.nio.charset.StandardCharsets;
 import java.util.ArrayList;
 import java.util.List;
+import java.util.concurrent.ArrayBlockingQueue;
+import java.util.concurrent.BlockingQueue;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ExecutionException;
+import java.util.concurrent.ForkJoinPool;
+import java.util.concurrent.Future;
+import java.util.concurrent.atomic.AtomicLong;
+import java.util.concurrent.atomic.AtomicReference;
+import java.util.concurrent.atomic.LongAdder;
 
 import org.apache.commons.cli.CommandLine;
 import org.apache.commons.cli.CommandLineParser;
@@ -13,6 +27,7 @@ import org.apache.commons.cli.Option;
 import org.apache.commons.cli.Options;
 import org.apache.commons.cli.ParseException;
 
+import htsjdk.samtools.BAMRecord;
 import htsjdk.samtools.SAMFileHeader;
 import htsjdk.samtools.SAMFileWriter;
 import htsjdk.samtools.SAMFileWriterFactory;
@@ -43,19 +58,44 @@ public class UmiRx {
 	public static final String MQ = SAMTag.MQ.name();
 	public static final String RX = SAMTag.RX.name();
 
+	public static final char[] CIGAR_OPS = "MIDNSHP=X".toCharArray();
 	public static final String HOME = System.getProperty("user.home");
 	public static long MAX_READS = 1000000;
 	public static long SHOW_EVERY = 1000000;
+	public static int BATCH_SIZE = 1000; // Read name groups per batch (parallel mode)
+	public static int BATCHES_PER_WORKER = 4; // Batches in flight per worker thread (parallel mode)
+	public static int OUT_BUFFER_SIZE = 4 * 1024 * 1024; // Output buffer (file or STDOUT)
+	public static int MAX_GROUP_SIZE = 100000; // Default max reads per read name group kept in memory
+
+	// Marks the end of the batches queue
+	static final Future<List<List<SAMRecord>>> END_OF_BATCHES = CompletableFuture.completedFuture(null);
+
+	/**
+	 * Mate mapping qualities and cigars of a read name group, computed one read at a time
+	 */
+	static class MateSummary {
+		boolean ok = true;
+		int mq1, mq2;
+		String cigar1 = "", cigar2 = "";
+	}
 
 	boolean calcRx, calcMc, calcMq;
+	ThreadLocal<StringBuilder> cigarBuilder = ThreadLocal.withInitial(StringBuilder::new); // Reused to decode raw cigars
+	ThreadLocal<ByteStringCache> cigarCache = ThreadLocal.withInitial(ByteStringCache::new); // Cigar strings, by raw cigar
 	int compressionLevel;
-	long countMc, countMq, countRx;
+	LongAdder countMc, countMq, countRx; // Updated from worker threads in parallel mode
 	boolean debug = false;
+	AtomicReference<Throwable> error = new AtomicReference<>(); // First error in parallel mode
 	String inBam, outBam;
+	int maxGroupSize = MAX_GROUP_SIZE; // Larger read name groups are spilled to a temporary file
 	SamReader samReader;
 	SAMFileWriter samWriter;
+	int threads;
+	ThreadLocal<ByteStringCache> umiCache = ThreadLocal.withInitial(ByteStringCache::new); // UMI strings, by raw UMI
+	boolean useNative = true; // Use the native backend (JNI) if available
 	boolean useSamOutput;
 	boolean verbose = true;
+	int workers;
 
 	public static void main(String[] args) {
 		// Parse command line
@@ -72,19 +112,37 @@ public class UmiRx {
 			int level = Integer.parseInt(compStr);
 			umirx.setCompressionLevel(level);
 		}
+		if (cmd.hasOption('u')) umirx.setCompressionLevel(0); // Uncompressed BAM
+
+		// Threads for async I/O and parallel compression
+		if (cmd.hasOption("threads")) {
+			String threadsStr = cmd.getOptionValue("threads");
+			umirx.setThreads(Integer.parseInt(threadsStr));
+		}
+
+		// Max reads per read name group kept in memory
+		if (cmd.hasOption("max-group")) {
+			String maxGroupStr = cmd.getOptionValue("max-group");
+			umirx.setMaxGroupSize(Integer.parseInt(maxGroupStr));
+		}
+
+		// Threads tagging read name groups in parallel (mate tags only)
+		if (cmd.hasOption("workers")) {
+			String workersStr = cmd.getOptionValue("workers");
+			umirx.setWorkers(Integer.parseInt(workersStr));
+		}
 
 		// Other options
 		umirx.setDebug(cmd.hasOption('v'));
 		umirx.setVerbose(cmd.hasOption('d'));
 		umirx.setUseSamOutput(cmd.hasOption('s'));
+		umirx.setUseNative(!cmd.hasOption("htsjdk"));
 		umirx.setCalcMc(cmd.hasOption('c'));
 		umirx.setCalcMq(cmd.hasOption('q'));
 		umirx.setCalcRx(cmd.hasOption('x'));
 
 		// Process BAM
-		umirx.open();
-		umirx.transform();
-		umirx.close();
+		umirx.run();
 	}
 
 	/**
@@ -100,11 +158,25 @@ public class UmiRx {
 		options.addOption(new Option("q", "mq", false, "Add MQ tag (mate mapping quality)"));
 		options.addOption(new Option("x", "rx", false, "Add RX tag (UMI from read name)"));
 		options.addOption(new Option("s", "sam", false, "Use SAM output format instead ob BAM"));
+		options.addOption(new Option("u", "uncompressed", false, "Uncompressed BAM output (BGZF level 0), e.g. to pipe into another tool"));
+		options.addOption(new Option(null, "htsjdk", false, "Always use htsjdk, even if the native backend (libumirx_jni) is available"));
 
 		Option comp = new Option("l", "comp", true, "Compression level for output BAM");
 		comp.setArgName("level");
 		options.addOption(comp);
 
+		Option threads = new Option("t", "threads", true, "Number of threads for output BAM compression (also enables async I/O). Default: 0");
+		threads.setArgName("num");
+		options.addOption(threads);
+
+		Option maxGroup = new Option("g", "max-group", true, "Max reads per read name group kept in memory (MC / MQ), larger groups are spilled to a temporary file. Default: " + MAX_GROUP_SIZE);
+		maxGroup.setArgName("num");
+		options.addOption(maxGroup);
+
+		Option workers = new Option("w", "workers", true, "Number of threads adding MC / MQ tags to read name groups in parallel. Default: 0");
+		workers.setArgName("num");
+		options.addOption(workers);
+
 		Option in = new Option("i", "in", true, "Input BAM. Default: STDIN");
 		comp.setArgName("level");
 		options.addOption(in);
@@ -151,7 +223,9 @@ public class UmiRx {
 		this.inBam = inBam;
 		this.outBam = outBam;
 		compressionLevel = BlockCompressedOutputStream.getDefaultCompressionLevel();
-		countMc = countMq = countRx = 0;
+		countMc = new LongAdder();
+		countMq = new LongAdder();
+		countRx = new LongAdder();
 	}
 
 	/**
@@ -160,7 +234,7 @@ public class UmiRx {
 	void addMc(SAMRecord sr, String cigarMate) {
 		if (calcMc && sr.getAttribute(MC) == null) {
 			sr.setAttribute(MC, cigarMate);
-			countMc++;
+			countMc.increment();
 		}
 	}
 
@@ -170,7 +244,7 @@ public class UmiRx {
 	void addMq(SAMRecord sr, int qualMate) {
 		if (calcMq && sr.getAttribute(MQ) == null) {
 			sr.setAttribute(MQ, qualMate);
-			countMq++;
+			countMq.increment();
 		}
 	}
 
@@ -185,13 +259,56 @@ public class UmiRx {
 	 *      UMI      : CGCACG
 	 */
 	protected void addRx(SAMRecord sr) {
-		if (!calcRx || sr.getAttribute(RX) != null) return;
-		String readName = sr.getReadName();
-		int idx = readName.lastIndexOf(':');
-		if (idx < 0) throw new RuntimeException("Could not find ':' in read name. Read: " + sr);
-		String umi = readName.substring(idx + 1);
+		addRx(sr, umiIfNeeded(sr));
+	}
+
+	/**
+	 * Add RX tag using a UMI already extracted from the read name (null if the tag is not needed)
+	 */
+	void addRx(SAMRecord sr, String umi) {
+		if (umi == null) return;
 		sr.setAttribute(RX, umi);
-		countRx++;
+		countRx.increment();
+	}
+
+	/**
+	 * Cigar string.
+	 * When the record's raw BAM data is available, the string is taken from
+	 * a cache keyed by the raw cigar (no Cigar objects or new strings)
+	 */
+	protected String cigarString(SAMRecord sr) {
+		byte[] raw = rawData(sr);
+		if (raw == null) return sr.getCigarString();
+
+		int n = sr.getCigarLength();
+		if (n == 0) return SAMRecord.NO_ALIGNMENT_CIGAR;
+		int start = readNameEnd(raw) + 1;
+		int end = start + 4 * n;
+		ByteStringCache cache = cigarCache.get();
+		String cigar = cache.get(raw, start, end);
+		if (cigar != null) return cigar;
+
+		// Decode raw cigar: little endian 'length << 4 | op'
+		StringBuilder sb = cigarBuilder.get();
+		sb.setLength(0);
+		for (int i = start; i < end; i += 4) {
+			int c = (raw[i] & 0xff) | (raw[i + 1] & 0xff) << 8 | (raw[i + 2] & 0xff) << 16 | (raw[i + 3] & 0xff) << 24;
+			int op = c & 0xf;
+			if (op >= CIGAR_OPS.length) return sr.getCigarString();
+			// Long cigars are stored in a 'CG' tag, the raw cigar is only a placeholder
+			if (n == 2 && i == start && op == 4 && (c >>> 4) == sr.getReadLength()) return sr.getCigarString();
+			sb.append(c >>> 4).append(CIGAR_OPS[op]);
+		}
+		cigar = sb.toString();
+		cache.put(raw, start, end, cigar);
+		return cigar;
+	}
+
+	/**
+	 * Can the native backend run this job? (it always adds RX tags and has no debug mode)
+	 */
+	boolean canRunNative() {
+		return useNative && calcRx && !debug && NativeUmiRx.isAvailable();
 	}
 
 	/**
@@ -210,6 +327,14 @@ public class UmiRx {
 		return compressionLevel;
 	}
 
+	public int getThreads() {
+		return threads;
+	}
+
+	public int getWorkers() {
+		return workers;
+	}
+
 	public boolean isDebug() {
 		return debug;
 	}
@@ -229,34 +354,122 @@ public class UmiRx {
 		// Open input BAM
 		SamInputResource samIn = inBam.equals("-") ? SamInputResource.of(System.in) : SamInputResource.of(inBam);
 
-		samReader = SamReaderFactory.make().validationStringency(ValidationStringency.LENIENT).open(samIn);
+		samReader = SamReaderFactory.make().validationStringency(ValidationStringency.LENIENT).setUseAsyncIo(threads > 0).open(samIn);
 		SAMFileHeader samHeader = samReader.getFileHeader();
 
 		// Create output BAM file
-		SAMFileWriterFactory swf = new SAMFileWriterFactory();
+		SAMFileWriterFactory swf = new SAMFileWriterFactory().setUseAsyncIo(threads > 0).setCompressionLevel(compressionLevel);
 		if (useSamOutput) {
-			samWriter = outBam.equals("-") ? swf.makeSAMWriter(samHeader, false, System.out) : swf.makeSAMWriter(samHeader, false, new File(outBam));
+			samWriter = outBam.equals("-") ? swf.makeSAMWriter(samHeader, false, openOutputStream()) : swf.makeSAMWriter(samHeader, false, new File(outBam));
+		} else if (threads > 0 && compressionLevel > 0) {
+			// BGZF blocks compressed in parallel (nothing to parallelize for uncompressed BAM)
+			samWriter = new ParallelBamWriter(samHeader, openOutputStream(), compressionLevel, threads);
 		} else {
-			samWriter = outBam.equals("-") ? swf.makeBAMWriter(samHeader, false, System.out) : swf.makeBAMWriter(samHeader, false, new File(outBam), compressionLevel);
+			samWriter = outBam.equals("-") ? swf.makeBAMWriter(samHeader, false, openOutputStream()) : swf.makeBAMWriter(samHeader, false, new File(outBam), compressionLevel);
 		}
 	}
 
-	protected void process(List<SAMRecord> srs) {
-		switch (srs.size()) {
-		case 0:
-			// No reads, nothing to do
-			break;
-		case 1:
-			process1(srs);
-			break;
-		case 2:
-			process2(srs);
-			break;
+	/**
+	 * Open output file (or STDOUT) as a buffered stream
+	 * Note: STDOUT is written directly (not through 'System.out', which
+	 * uses a small buffer and synchronizes on every write)
+	 */
+	OutputStream openOutputStream() {
+		if (outBam.equals("-")) return new BufferedOutputStream(new FileOutputStream(FileDescriptor.out), OUT_BUFFER_SIZE);
+		try {
+			return new BufferedOutputStream(new FileOutputStream(outBam), OUT_BUFFER_SIZE);
+		} catch (IOException e) {
+			throw new RuntimeException(e);
+		}
+	}
+
+	/**
+	 * Raw BAM data (read name, cigar, bases, qualities and tags), null if not available or
+	 * the record has been modified
+	 */
+	byte[] rawData(SAMRecord sr) {
+		return sr instanceof BAMRecord ? ((BAMRecord) sr).getVariableBinaryRepresentation() : null;
+	}
+
+	/**
+	 * Does the record have an RX tag?
+	 * When the record's raw BAM data is available, the tags are scanned in place
+	 * (getAttribute would decode the whole tag list)
+	 */
+	boolean hasRx(SAMRecord sr) {
+		byte[] raw = rawData(sr);
+		int size = raw != null ? ((BAMRecord) sr).getAttributesBinarySize() : -1;
+		if (size < 0) return sr.getAttribute(RX) != null;
+
+		for (int i = raw.length - size; i + 3 <= raw.length;) {
+			if (raw[i] == 'R' && raw[i + 1] == 'X') return true;
+			int len = tagValueSize(raw, i + 2);
+			if (len < 0 || len > raw.length - i - 3) return sr.getAttribute(RX) != null; // Malformed, let htsjdk decide
+			i += 3 + len;
+		}
+		return false;
+	}
+
+	/**
+	 * Size of a raw tag value (after the type at 'i'), -1 if invalid
+	 */
+	int tagValueSize(byte[] raw, int i) {
+		switch (raw[i]) {
+		case 'Z':
+		case 'H':
+			for (int j = i + 1; j < raw.length; j++)
+				if (raw[j] == 0) return j - i;
+			return -1;
+		case 'B':
+			if (i + 6 > raw.length) return -1;
+			int elemSize = tagTypeSize(raw[i + 1]);
+			int count = (raw[i + 2] & 0xff) | (raw[i + 3] & 0xff) << 8 | (raw[i + 4] & 0xff) << 16 | (raw[i + 5] & 0xff) << 24;
+			return elemSize > 0 && count >= 0 && count <= (raw.length - i - 6) / elemSize ? 5 + count * elemSize : -1;
 		default:
-			process3orMore(srs);
+			return tagTypeSize(raw[i]);
 		}
 	}
 
+	/**
+	 * Size of a fixed size tag type, -1 if not fixed size
+	 */
+	int tagTypeSize(byte type) {
+		switch (type) {
+		case 'A':
+		case 'c':
+		case 'C':
+			return 1;
+		case 's':
+		case 'S':
+			return 2;
+		case 'i':
+		case 'I':
+		case 'f':
+			return 4;
+		default:
+			return -1;
+		}
+	}
+
+	/**
+	 * Position of the read name's null terminator in raw BAM data
+	 */
+	int readNameEnd(byte[] raw) {
+		int i = 0;
+		while (raw[i] != 0)
+			i++;
+		return i;
+	}
+
+	/**
+	 * Add tags to a list of reads having the same read name, then write them
+	 */
+	protected void process(List<SAMRecord> srs) {
+		tag(srs);
+		for (SAMRecord sr : srs)
+			samWriter.addAlignment(sr);
+	}
+
 	/**
 	 * Process list of reads containing only one read
 	 */
@@ -265,7 +478,6 @@ public class UmiRx {
 		addRx(sr);
 		addMq(sr, 0);
 		addMc(sr, "");
-		samWriter.addAlignment(sr);
 	}
 
 	/**
@@ -278,8 +490,12 @@ public class UmiRx {
 
 		int mq1 = sr1.getMappingQuality();
 		int mq2 = sr2.getMappingQuality();
-		String cigar1 = sr1.getCigarString();
-		String cigar2 = sr2.getCigarString();
+		String cigar1 = cigarString(sr1);
+		String cigar2 = cigarString(sr2);
+
+		// Get UMIs before any tag is added (raw record data is no longer available after that)
+		String umi1 = umiIfNeeded(sr1);
+		String umi2 = umiIfNeeded(sr2);
 
 		// MQ tags is the mapping quality of "mate read"
 		addMq(sr1, mq2);
@@ -290,56 +506,104 @@ public class UmiRx {
 		addMc(sr2, cigar1);
 
 		// Add UMIs
-		addRx(sr1);
-		addRx(sr2);
-
-		// Save
-		samWriter.addAlignment(sr1);
-		samWriter.addAlignment(sr2);
+		addRx(sr1, umi1);
+		addRx(sr2, umi2);
 	}
 
 	/**
 	 * Process a pair of SAM records
 	 */
 	protected void process3orMore(List<SAMRecord> srs) {
-		boolean ok = true;
-		int mq1 = 0, mq2 = 0;
-		String cigar1 = "", cigar2 = "";
-
 		// Get mapping qualities
-		for (SAMRecord sr : srs) {
-			if (sr.getReadUnmappedFlag() || sr.getMateUnmappedFlag()) {
-				ok = false;
-			} else if (sr.getFirstOfPairFlag()) {
-				mq1 = Math.max(mq1, sr.getMappingQuality());
-				if (cigar1.isEmpty() || !sr.isSecondaryOrSupplementary()) cigar1 = sr.getCigarString();
-			} else if (sr.getSecondOfPairFlag()) {
-				mq2 = Math.max(mq1, sr.getMappingQuality());
-				if (cigar2.isEmpty() || !sr.isSecondaryOrSupplementary()) cigar2 = sr.getCigarString();
-			}
+		MateSummary ms = new MateSummary();
+		for (SAMRecord sr : srs)
+			summarize(ms, sr);
+
+		// Set RX, MQ
+		for (SAMRecord sr : srs)
+			tagMates(ms, sr);
+	}
+
+	/**
+	 * Add a batch to the queue (parallel mode)
+	 */
+	void putBatch(BlockingQueue<Future<? extends List<? extends Iterable<SAMRecord>>>> batches, Future<? extends List<? extends Iterable<SAMRecord>>> batch) {
+		try {
+			batches.put(batch);
+		} catch (InterruptedException e) {
+			throw new RuntimeException(e);
 		}
+	}
+
+	/**
+	 * Read name groups, send batches of groups to be tagged by the pool (parallel mode)
+	 * Returns the number of reads
+	 */
+	long readBatches(ForkJoinPool pool, BlockingQueue<Future<? extends List<? extends Iterable<SAMRecord>>>> batches) {
+		long readNum = 0;
+		List<List<SAMRecord>> batch = new ArrayList<>();
+		List<SAMRecord> srs = new ArrayList<>();
+		GroupSpill spill = null;
+
+		String readNamePrev = "";
+		for (SAMRecord sr : samReader) {
+			if (error.get() != null) break;
 
-		if (!ok) mq1 = mq2 = 0;
-
-		// Set RX, MQ and save
-		for (SAMRecord sr : srs) {
-			addRx(sr); // Add RX tag
-
-			// Add MQ tag (mapping quality of paired read)
-			if (sr.getFirstOfPairFlag()) {
-				addMq(sr, mq2);
-				addMc(sr, cigar2);
-			} else if (sr.getSecondOfPairFlag()) {
-				addMq(sr, mq1);
-				addMc(sr, cigar1);
-			} else {
-				System.err.println("WARNIGN: Neither first nor second pair " + sr);
-				addMq(sr, 0);
-				addMc(sr, "");
+			// Collect all reads with the same name in a list, add the list to the batch when the read name changes
+			String readName = sr.getReadName();
+			if (!readName.equals(readNamePrev) && spill != null) {
+				// Spilled group: send pending batch, then the group (tagged while replayed by the writer)
+				if (!batch.isEmpty()) submitBatch(pool, batches, batch);
+				putBatch(batches, CompletableFuture.completedFuture(List.of(spill)));
+				batch = new ArrayList<>();
+				spill = null;
+			} else if (!readName.equals(readNamePrev) && !srs.isEmpty()) {
+				batch.add(srs);
+				srs = new ArrayList<>();
+				if (batch.size() >= BATCH_SIZE) {
+					submitBatch(pool, batches, batch);
+					batch = new ArrayList<>();
+				}
 			}
 
-			// Save
-			samWriter.addAlignment(sr);
+			if (spill != null) spill.add(sr);
+			else {
+				srs.add(sr);
+				if (srs.size() > maxGroupSize) {
+					spill = spill(srs);
+					srs = new ArrayList<>();
+				}
+			}
+
+			// Prepare for next iteration
+			readNamePrev = readName;
+
+			// Show progress
+			if (readNum % SHOW_EVERY == 0) System.err.println(readNum + "\t" + sr + "\tcountMc: " + countMc + "\tcountMq: " + countMq + "\tcountRx: " + countRx);
+			if (debug && readNum > MAX_READS) {
+				System.err.println("WARNING: Debug mode, breaking after " + MAX_READS + " reads");
+				break;
+			}
+			readNum++;
+		}
+
+		// Last batch
+		if (!srs.isEmpty()) batch.add(srs);
+		if (!batch.isEmpty()) submitBatch(pool, batches, batch);
+		if (spill != null) putBatch(batches, CompletableFuture.completedFuture(List.of(spill)));
+		return readNum;
+	}
+
+	/**
+	 * Process input BAM: the whole job runs in the native backend if possible, otherwise using htsjdk
+	 */
+	public void run() {
+		if (canRunNative()) {
+			transformNative();
+		} else {
+			open();
+			transform();
+			close();
 		}
 	}
 
@@ -363,6 +627,18 @@ public class UmiRx {
 		this.debug = debug;
 	}
 
+	public void setMaxGroupSize(int maxGroupSize) {
+		this.maxGroupSize = Math.max(2, maxGroupSize);
+	}
+
+	public void setThreads(int threads) {
+		this.threads = threads;
+	}
+
+	public void setUseNative(boolean useNative) {
+		this.useNative = useNative;
+	}
+
 	public void setUseSamOutput(boolean useSamOutput) {
 		this.useSamOutput = useSamOutput;
 	}
@@ -371,9 +647,91 @@ public class UmiRx {
 		this.verbose = verbose;
 	}
 
+	public void setWorkers(int workers) {
+		this.workers = workers;
+	}
+
+	/**
+	 * Move a large read name group to a temporary file
+	 */
+	GroupSpill spill(List<SAMRecord> srs) {
+		if (verbose) System.err.println("WARNING: More than " + maxGroupSize + " reads named '" + srs.get(0).getReadName() + "', using a temporary file");
+		GroupSpill spill = new GroupSpill(this, samReader.getFileHeader());
+		for (SAMRecord sr : srs)
+			spill.add(sr);
+		return spill;
+	}
+
+	/**
+	 * Tag a batch in the pool, the queue keeps batches in input order (blocks if the queue is full)
+	 */
+	void submitBatch(ForkJoinPool pool, BlockingQueue<Future<? extends List<? extends Iterable<SAMRecord>>>> batches, List<List<SAMRecord>> batch) {
+		putBatch(batches, pool.submit(() -> {
+			for (List<SAMRecord> srs : batch)
+				tag(srs);
+			return batch;
+		}));
+	}
+
+	/**
+	 * Update mate summary (mapping qualities and cigars) with a read
+	 */
+	void summarize(MateSummary ms, SAMRecord sr) {
+		if (sr.getReadUnmappedFlag() || sr.getMateUnmappedFlag()) {
+			ms.ok = false;
+		} else if (sr.getFirstOfPairFlag()) {
+			ms.mq1 = Math.max(ms.mq1, sr.getMappingQuality());
+			if (ms.cigar1.isEmpty() || !sr.isSecondaryOrSupplementary()) ms.cigar1 = cigarString(sr);
+		} else if (sr.getSecondOfPairFlag()) {
+			ms.mq2 = Math.max(ms.mq2, sr.getMappingQuality());
+			if (ms.cigar2.isEmpty() || !sr.isSecondaryOrSupplementary()) ms.cigar2 = cigarString(sr);
+		}
+	}
+
+	/**
+	 * Add tags to a list of reads having the same read name (does not write them)
+	 */
+	protected void tag(List<SAMRecord> srs) {
+		switch (srs.size()) {
+		case 0:
+			// No reads, nothing to do
+			break;
+		case 1:
+			process1(srs);
+			break;
+		case 2:
+			process2(srs);
+			break;
+		default:
+			process3orMore(srs);
+		}
+	}
+
+	/**
+	 * Add RX, MQ and MC tags to a read, using the mate summary of its read name group
+	 */
+	void tagMates(MateSummary ms, SAMRecord sr) {
+		addRx(sr); // Add RX tag
+
+		// Add MQ tag (mapping quality of paired read)
+		if (sr.getFirstOfPairFlag()) {
+			addMq(sr, ms.ok ? ms.mq2 : 0);
+			addMc(sr, ms.cigar2);
+		} else if (sr.getSecondOfPairFlag()) {
+			addMq(sr, ms.ok ? ms.mq1 : 0);
+			addMc(sr, ms.cigar1);
+		} else {
+			System.err.println("WARNIGN: Neither first nor second pair " + sr);
+			addMq(sr, 0);
+			addMc(sr, "");
+		}
+	}
+
 	public void transform() {
-		if (calcMc || calcMq) transformM();
-		else transformRx();
+		if (calcMc || calcMq) {
+			if (workers > 0) transformMParallel();
+			else transformM();
+		} else transformRx();
 	}
 
 	/**
@@ -384,6 +742,7 @@ public class UmiRx {
 	protected void transformM() {
 		long readNum = 0;
 		List<SAMRecord> srs = new ArrayList<>();
+		GroupSpill spill = null;
 
 		String readNamePrev = "";
 		for (SAMRecord sr : samReader) {
@@ -393,10 +752,21 @@ public class UmiRx {
 			String readName = sr.getReadName();
 			if (!readName.equals(readNamePrev)) {
 				// Read name changed, process reads, then clear list
-				process(srs);
+				if (spill != null) write(spill);
+				else process(srs);
+				spill = null;
 				srs.clear();
 			}
-			srs.add(sr);
+
+			// Groups larger than 'maxGroupSize' are moved to a temporary file
+			if (spill != null) spill.add(sr);
+			else {
+				srs.add(sr);
+				if (srs.size() > maxGroupSize) {
+					spill = spill(srs);
+					srs.clear();
+				}
+			}
 
 			// Prepare for next iteration
 			readNamePrev = readName;
@@ -410,7 +780,68 @@ public class UmiRx {
 			readNum++;
 		}
 
-		process(srs); // Process last list of reads
+		// Process last list of reads
+		if (spill != null) write(spill);
+		else process(srs);
+		System.err.println(readNum + "\tcountMc: " + countMc + "\tcountMq: " + countMq + "\tcountRx: " + countRx);
+	}
+
+	/**
+	 * Run the whole job in the native backend (C engine, htslib threads for BGZF)
+	 */
+	protected void transformNative() {
+		if (verbose) System.err.println("Using native backend (libumirx_jni)");
+		int flags = (calcMc ? NativeUmiRx.MC : 0) | (calcMq ? NativeUmiRx.MQ : 0);
+		long readNum = NativeUmiRx.run(inBam, outBam, flags, compressionLevel, useSamOutput, threads);
+		if (readNum < 0) throw new RuntimeException("Native backend failed, input '" + inBam + "', output '" + outBam + "'");
+	}
+
+	/**
+	 * Same as transformM, using a pipeline:
+	 * 		- A reader thread collects read name groups into batches
+	 * 		- Batches are tagged in parallel (ForkJoinPool with 'workers' threads)
+	 * 		- The calling thread writes batches in input order
+	 * At most 'BATCHES_PER_WORKER * workers' batches are in flight, so memory stays flat
+	 */
+	protected void transformMParallel() {
+		ForkJoinPool pool = new ForkJoinPool(workers);
+		BlockingQueue<Future<? extends List<? extends Iterable<SAMRecord>>>> batches = new ArrayBlockingQueue<>(BATCHES_PER_WORKER * workers);
+		AtomicLong readNum = new AtomicLong();
+
+		Thread reader = new Thread(() -> {
+			try {
+				readNum.set(readBatches(pool, batches));
+			} catch (Throwable t) {
+				error.compareAndSet(null, t);
+			} finally {
+				putBatch(batches, END_OF_BATCHES);
+			}
+		}, "umirx-reader");
+		reader.start();
+
+		// Write batches in order. After an error, keep draining the queue so the reader never blocks
+		try {
+			for (Future<? extends List<? extends Iterable<SAMRecord>>> batch; (batch = batches.take()) != END_OF_BATCHES;) {
+				if (error.get() != null) continue;
+				try {
+					for (Iterable<SAMRecord> srs : batch.get())
+						for (SAMRecord sr : srs)
+							samWriter.addAlignment(sr);
+				} catch (ExecutionException e) {
+					error.compareAndSet(null, e.getCause());
+				} catch (RuntimeException e) {
+					error.compareAndSet(null, e);
+				}
+			}
+			reader.join();
+		} catch (InterruptedException e) {
+			throw new RuntimeException(e);
+		} finally {
+			pool.shutdown();
+		}
+
+		Throwable t = error.get();
+		if (t != null) throw t instanceof RuntimeException ? (RuntimeException) t : new RuntimeException(t);
 		System.err.println(readNum + "\tcountMc: " + countMc + "\tcountMq: " + countMq + "\tcountRx: " + countRx);
 	}
 
@@ -437,4 +868,50 @@ public class UmiRx {
 		System.err.println(readNum + "\tcountMc: " + countMc + "\tcountMq: " + countMq + "\tcountRx: " + countRx);
 	}
 
+	/**
+	 * UMI from read name.
+	 * When the record's raw BAM data is available, the UMI is found in the raw read name
+	 * and taken from a cache (no read name or UMI strings are created)
+	 */
+	protected String umi(SAMRecord sr) {
+		byte[] raw = rawData(sr);
+		if (raw == null) {
+			String readName = sr.getReadName();
+			int idx = readName.lastIndexOf(':');
+			if (idx < 0) throw new RuntimeException("Could not find ':' in read name. Read: " + sr);
+			return readName.substring(idx + 1);
+		}
+
+		int end = readNameEnd(raw);
+		int idx = end - 1;
+		while (idx >= 0 && raw[idx] != ':')
+			idx--;
+		if (idx < 0) throw new RuntimeException("Could not find ':' in read name. Read: " + sr);
+
+		ByteStringCache cache = umiCache.get();
+		String umi = cache.get(raw, idx + 1, end);
+		if (umi == null) {
+			umi = new String(raw, idx + 1, end - idx - 1, StandardCharsets.US_ASCII);
+			cache.put(raw, idx + 1, end, umi);
+		}
+		return umi;
+	}
+
+	/**
+	 * UMI if the RX tag has to be added, null otherwise
+	 */
+	String umiIfNeeded(SAMRecord sr) {
+		return calcRx && !hasRx(sr) ? umi(sr) : null;
+	}
+
+	/**
+	 * Replay a spilled read name group (adding tags) and write it
+	 */
+	void write(GroupSpill spill) {
+		try (GroupSpill gs = spill) {
+			for (SAMRecord sr : gs)
+				samWriter.addAlignment(sr);
+		}
+	}
+
 }
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "mate.h"
+#include "probes.h"
+
+#define IS_SECONDARY_OR_SUPPLEMENTARY(b) (((b)->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) != 0)
+#define IS_UNMAPPED(b) (((b)->core.flag & BAM_FUNMAP) != 0)
+#define MATE_SCORE_MIN_QUAL 15
+
+void mate_tags_init(mate_tags_t *m, int calc_mc, int calc_mq) {
+    memset(m, 0, sizeof(mate_tags_t));
+    m->calc_mc = calc_mc;
+    m->calc_mq = calc_mq;
+}
+
+void mate_tags_destroy(mate_tags_t *m) {
+    ks_free(&m->cigar1);
+    ks_free(&m->cigar2);
+}
+
+// Cigar string of a record ('*' if there is no cigar)
+static void cigar_str(const bam1_t *b, kstring_t *s) {
+    s->l = 0;
+    uint32_t *cigar = bam_get_cigar(b);
+    for (uint32_t i = 0; i < b->core.n_cigar; i++) {
+        kputw(bam_cigar_oplen(cigar[i]), s);
+        kputc(bam_cigar_opchr(cigar[i]), s);
+    }
+    if (b->core.n_cigar == 0) kputc('*', s);
+}
+
+// Add MC tag, if it doesn't exist
+static int add_mc(mate_tags_t *m, bam1_t *b, kstring_t *cigar_mate) {
+    if (bam_aux_get(b, "MC")) return 0;
+    if (bam_aux_append(b, "MC", 'Z', cigar_mate->l + 1, (uint8_t *) (cigar_mate->s ? cigar_mate->s : "")) < 0) return -1;
+    m->count_mc++;
+    return 0;
+}
+
+// Add MQ tag, if it doesn't exist
+static int add_mq(mate_tags_t *m, bam1_t *b, int qual_mate) {
+    if (bam_aux_get(b, "MQ")) return 0;
+    uint8_t mq = qual_mate;
+    if (bam_aux_append(b, "MQ", 'C', 1, &mq) < 0) return -1;
+    m->count_mq++;
+    return 0;
+}
+
+// Find primary first and second of pair. Returns 0 if there isn't exactly one of each
+static int find_primary_pair(bam1_t **recs, int n, bam1_t **r1, bam1_t **r2) {
+    *r1 = *r2 = NULL;
+    for (int i = 0; i < n; i++) {
+        bam1_t *b = recs[i];
+        if (IS_SECONDARY_OR_SUPPLEMENTARY(b) || !(b->core.flag & BAM_FPAIRED)) continue;
+        bam1_t **r = (b->core.flag & BAM_FREAD1) ? r1 : (b->core.flag & BAM_FREAD2) ? r2 : NULL;
+        if (!r || *r) return 0;
+        *r = b;
+    }
+    return *r1 && *r2;
+}
+
+// Mate score: sum of base qualities >= 15 (same as 'samtools fixmate -m')
+static int mate_score(const bam1_t *b) {
+    const uint8_t *qual = bam_get_qual(b);
+    if (b->core.l_qseq == 0 || qual[0] == 0xff) return 0;
+    int score = 0;
+    for (int i = 0; i < b->core.l_qseq; i++)
+        if (qual[i] >= MATE_SCORE_MIN_QUAL) score += qual[i];
+    return score;
+}
+
+// Set mate reference, position and flags of 'b' from its mate
+static void sync_mate_info(bam1_t *b, const bam1_t *mate) {
+    b->core.mtid = mate->core.tid;
+    b->core.mpos = mate->core.pos;
+    b->core.flag &= ~(BAM_FMREVERSE | BAM_FMUNMAP);
+    if (mate->core.flag & BAM_FREVERSE) b->core.flag |= BAM_FMREVERSE;
+    if (mate->core.flag & BAM_FUNMAP) b->core.flag |= BAM_FMUNMAP;
+}
+
+/*
+ * Template length, as 'samtools fixmate': distance between the 5' ends (the end
+ * position for reverse strand reads), positive for the read with the leftmost 5' end
+ */
+static void set_tlen(bam1_t *r1, bam1_t *r2) {
+    if (IS_UNMAPPED(r1) || IS_UNMAPPED(r2) || r1->core.tid != r2->core.tid) {
+        r1->core.isize = r2->core.isize = 0;
+        return;
+    }
+    hts_pos_t pos1 = (r1->core.flag & BAM_FREVERSE) ? bam_endpos(r1) : r1->core.pos;
+    hts_pos_t pos2 = (r2->core.flag & BAM_FREVERSE) ? bam_endpos(r2) : r2->core.pos;
+    r1->core.isize = pos2 - pos1;
+    r2->core.isize = pos1 - pos2;
+}
+
+// Fix mate information of a primary pair
+static void fixmate_pair(bam1_t *r1, bam1_t *r2) {
+    // Unmapped reads are placed at their mate's position
+    if (IS_UNMAPPED(r1) && !IS_UNMAPPED(r2)) {
+        r1->core.tid = r2->core.tid;
+        r1->core.pos = r2->core.pos;
+    } else if (IS_UNMAPPED(r2) && !IS_UNMAPPED(r1)) {
+        r2->core.tid = r1->core.tid;
+        r2->core.pos = r1->core.pos;
+    }
+    if (IS_UNMAPPED(r1) || IS_UNMAPPED(r2)) {
+        r1->core.flag &= ~BAM_FPROPER_PAIR;
+        r2->core.flag &= ~BAM_FPROPER_PAIR;
+    }
+
+    sync_mate_info(r1, r2);
+    sync_mate_info(r2, r1);
+    set_tlen(r1, r2);
+}
+
+/*
+ * Fix mate information and add 'ms' tags, using the primary alignments of the pair.
+ * Secondary and supplementary alignments get the mate information from the mate's primary
+ * Returns -1 on error
+ */
+static inline __attribute__((always_inline)) int fixmate_group(mate_tags_t *m, bam1_t **recs, int n, const int calc_ms, const int fixmate) {
+    bam1_t *r1, *r2;
+    if (!find_primary_pair(recs, n, &r1, &r2)) return 0;
+
+    if (fixmate) {
+        fixmate_pair(r1, r2);
+        for (int i = 0; i < n; i++) {
+            bam1_t *b = recs[i];
+            if (b == r1 || b == r2) continue;
+            if (b->core.flag & BAM_FREAD1) sync_mate_info(b, r2);
+            else if (b->core.flag & BAM_FREAD2) sync_mate_info(b, r1);
+        }
+        m->count_fixmate++;
+    }
+
+    if (calc_ms) {
+        int score1 = mate_score(r1), score2 = mate_score(r2);
+        for (int i = 0; i < n; i++) {
+            bam1_t *b = recs[i];
+            int score = (b->core.flag & BAM_FREAD1) ? score2 : (b->core.flag & BAM_FREAD2) ? score1 : -1;
+            if (score < 0) continue;
+            if (bam_aux_update_int(b, "ms", score) < 0) return -1;
+            m->count_ms++;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Add MC/MQ tags to a group of records with the same read name.
+ * Fix mate information and add 'ms' tags if requested.
+ * The tag set ('calc_mc', 'calc_mq', 'calc_ms', 'fixmate') is a compile time
+ * constant in each specialization (see MATE_GROUP). Returns -1 on error
+ */
+static inline __attribute__((always_inline)) int mate_group(mate_tags_t *m, bam1_t **recs, int n, const int calc_mc, const int calc_mq, const int calc_ms, const int fixmate) {
+    UMI_PROBE1(name_group, n);
+    if ((fixmate || calc_ms) && fixmate_group(m, recs, n, calc_ms, fixmate) < 0) return -1;
+    if (!calc_mc && !calc_mq) return 0;
+
+    switch (n) {
+    case 0:
+        // No reads, nothing to do
+        return 0;
+
+    case 1:
+        m->cigar1.l = 0;
+        kputs("", &m->cigar1);
+        if (calc_mq && add_mq(m, recs[0], 0) < 0) return -1;
+        if (calc_mc && add_mc(m, recs[0], &m->cigar1) < 0) return -1;
+        return 0;
+
+    case 2:
+        // This is the most common case (assuming pair-end reads)
+        if (calc_mq && (add_mq(m, recs[0], recs[1]->core.qual) < 0 || add_mq(m, recs[1], recs[0]->core.qual) < 0)) return -1;
+        if (calc_mc) {
+            cigar_str(recs[0], &m->cigar1);
+            cigar_str(recs[1], &m->cigar2);
+            if (add_mc(m, recs[0], &m->cigar2) < 0 || add_mc(m, recs[1], &m->cigar1) < 0) return -1;
+        }
+        return 0;
+
+    default:
+        break;
+    }
+
+    // Three or more reads (secondary / supplementary alignments)
+    int ok = 1, mq1 = 0, mq2 = 0, has_cigar1 = 0, has_cigar2 = 0;
+    m->cigar1.l = m->cigar2.l = 0;
+    kputs("", &m->cigar1);
+    kputs("", &m->cigar2);
+    for (int i = 0; i < n; i++) {
+        bam1_t *b = recs[i];
+        if (b->core.flag & (BAM_FUNMAP | BAM_FMUNMAP)) {
+            ok = 0;
+        } else if (b->core.flag & BAM_FREAD1) {
+            if (b->core.qual > mq1) mq1 = b->core.qual;
+            if (calc_mc && (!has_cigar1 || !IS_SECONDARY_OR_SUPPLEMENTARY(b))) cigar_str(b, &m->cigar1);
+            has_cigar1 = 1;
+        } else if (b->core.flag & BAM_FREAD2) {
+            if (b->core.qual > mq2) mq2 = b->core.qual;
+            if (calc_mc && (!has_cigar2 || !IS_SECONDARY_OR_SUPPLEMENTARY(b))) cigar_str(b, &m->cigar2);
+            has_cigar2 = 1;
+        }
+    }
+
+    if (!ok) mq1 = mq2 = 0;
+
+    kstring_t empty = KS_INITIALIZE;
+    for (int i = 0; i < n; i++) {
+        bam1_t *b = recs[i];
+        int qual_mate = 0;
+        kstring_t *cigar_mate = &empty;
+        if (b->core.flag & BAM_FREAD1) {
+            qual_mate = mq2;
+            cigar_mate = &m->cigar2;
+        } else if (b->core.flag & BAM_FREAD2) {
+            qual_mate = mq1;
+            cigar_mate = &m->cigar1;
+        } else {
+            fprintf(stderr, "WARNING: Neither first nor second pair, read_name='%s'\n", bam_get_qname(b));
+        }
+        if (calc_mq && add_mq(m, b, qual_mate) < 0) return -1;
+        if (calc_mc && add_mc(m, b, cigar_mate) < 0) return -1;
+    }
+
+    return 0;
+}
+
+// One specialization for each tag set
+#define MATE_GROUP(mc, mq, ms, fix) \
+    static int mate_group_##mc##mq##ms##fix(mate_tags_t *m, bam1_t **recs, int n) { \
+        return mate_group(m, recs, n, mc, mq, ms, fix); \
+    }
+
+#define MATE_GROUP_ALL(mc, mq) \
+    MATE_GROUP(mc, mq, 0, 0) \
+    MATE_GROUP(mc, mq, 0, 1) \
+    MATE_GROUP(mc, mq, 1, 0) \
+    MATE_GROUP(mc, mq, 1, 1)
+
+MATE_GROUP(0, 0, 0, 1)  // No tags at all: no specialization
+MATE_GROUP(0, 0, 1, 0)
+MATE_GROUP(0, 0, 1, 1)
+MATE_GROUP_ALL(0, 1)
+MATE_GROUP_ALL(1, 0)
+MATE_GROUP_ALL(1, 1)
+
+#define MATE_GROUP_ENTRY(mc, mq) \
+    {{mate_group_##mc##mq##00, mate_group_##mc##mq##01}, {mate_group_##mc##mq##10, mate_group_##mc##mq##11}}
+
+// Indexed by [calc_mc][calc_mq][calc_ms][fixmate]. No tags: NULL (records are not grouped)
+static const mate_group_f mate_group_table[2][2][2][2] = {
+    {{{NULL, mate_group_0001}, {mate_group_0010, mate_group_0011}}, MATE_GROUP_ENTRY(0, 1)},
+    {MATE_GROUP_ENTRY(1, 0), MATE_GROUP_ENTRY(1, 1)}
+};
+
+// Mate tag loop specialized for the tag set in 'm', NULL if there is nothing to do
+mate_group_f mate_tags_select(const mate_tags_t *m) {
+    return mate_group_table[m->calc_mc != 0][m->calc_mq != 0][m->calc_ms != 0][m->fixmate != 0];
+}
+
+/*
+ * Add MC/MQ tags to a group of records with the same read name.
+ * Fix mate information and add 'ms' tags if requested.
+ * Returns -1 on error
+ */
+int mate_tags_group(mate_tags_t *m, bam1_t **recs, int n) {
+    mate_group_f group = mate_tags_select(m);
+    return group ? group(m, recs, n) : 0;
+}
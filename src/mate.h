@@ -0,0 +1,30 @@
+#ifndef UMI_RX_MATE_H
+#define UMI_RX_MATE_H
+
+#include "htslib/sam.h"
+
+/*
+ * Add mate tags (MC: mate cigar, MQ: mate mapping quality) to a group
+ * of records having the same read name.
+ * Same logic as the Java version ('UmiRx.process')
+ *
+ * Optionally, like 'samtools fixmate', add 'ms' (mate score) tags and fix
+ * mate information (mate reference, position, flags and template length)
+ */
+struct mate_tags_t;
+typedef int (*mate_group_f)(struct mate_tags_t *m, bam1_t **recs, int n);
+
+typedef struct mate_tags_t {
+    int calc_mc, calc_mq, calc_ms;      // Tags to add
+    int fixmate;                        // Fix mate information
+    long count_mc, count_mq, count_ms;  // Number of tags added
+    long count_fixmate;                 // Number of pairs fixed
+    kstring_t cigar1, cigar2;           // Cigar strings for first / second of pair
+} mate_tags_t;
+
+void mate_tags_init(mate_tags_t *m, int calc_mc, int calc_mq);
+void mate_tags_destroy(mate_tags_t *m);
+mate_group_f mate_tags_select(const mate_tags_t *m);
+int mate_tags_group(mate_tags_t *m, bam1_t **recs, int n);
+
+#endif
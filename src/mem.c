@@ -0,0 +1,53 @@
+#include <sys/resource.h>
+
+#include "mem.h"
+#include "stats.h"
+
+#ifndef UMI_RX_ALLOCATOR
+#define UMI_RX_ALLOCATOR "libc"    // Set by 'ALLOCATOR=... script/make_c.sh'
+#endif
+
+typedef struct mem_counter_t {
+    int64_t current, peak;
+} __attribute__((aligned(STATS_CACHE_LINE))) mem_counter_t;
+
+static mem_counter_t counters[MEM_N + 1];  // Last one: total
+static const char *subsystem_names[MEM_N] = {"batches", "mate", "groups", "trace"};
+
+static void counter_add(mem_counter_t *c, int64_t bytes) {
+    int64_t current = __atomic_add_fetch(&c->current, bytes, __ATOMIC_RELAXED);
+    int64_t peak = __atomic_load_n(&c->peak, __ATOMIC_RELAXED);
+    while (current > peak && !__atomic_compare_exchange_n(&c->peak, &peak, current, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        // 'peak' was updated by the failed exchange, retry
+    }
+}
+
+void mem_add(int subsystem, int64_t bytes) {
+    counter_add(&counters[subsystem], bytes);
+    counter_add(&counters[MEM_N], bytes);
+}
+
+int64_t mem_peak(int subsystem) {
+    return __atomic_load_n(&counters[subsystem].peak, __ATOMIC_RELAXED);
+}
+
+int64_t mem_peak_total(void) {
+    return mem_peak(MEM_N);
+}
+
+const char *mem_subsystem_name(int subsystem) {
+    return subsystem_names[subsystem];
+}
+
+const char *mem_allocator(void) {
+    return UMI_RX_ALLOCATOR;
+}
+
+// Peak memory per subsystem (MB), for the final report
+void mem_report(FILE *fp) {
+    struct rusage ru;
+    long rss_peak = getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss / 1024 : -1;  // Linux: kilobytes
+    fprintf(fp, "Memory peak (MB):");
+    for (int i = 0; i < MEM_N; i++) fprintf(fp, "\t%s: %.1f", subsystem_names[i], mem_peak(i) / 1048576.0);
+    fprintf(fp, "\ttotal: %.1f\trss: %ld\tallocator: %s\n", mem_peak_total() / 1048576.0, rss_peak, mem_allocator());
+}
@@ -0,0 +1,34 @@
+#ifndef UMI_RX_MEM_H
+#define UMI_RX_MEM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Subsystems with memory accounting
+#define MEM_BATCHES 0   // Pipeline batches: record arrays and records (including their data)
+#define MEM_MATE 1      // Mate tag buffers
+#define MEM_GROUPS 2    // Read name groups (zipper)
+#define MEM_TRACE 3     // Trace ring buffers
+#define MEM_N 4
+
+/*
+ * Allocation accounting of the tool's own buffers: current and peak bytes
+ * per subsystem. Buffers are accounted by capacity, updated when they grow
+ * (not on every allocation), so the cost is negligible.
+ * Memory allocated by htslib (e.g. BGZF blocks) is not included.
+ */
+void mem_add(int subsystem, int64_t bytes);
+int64_t mem_peak(int subsystem);
+int64_t mem_peak_total(void);
+const char *mem_subsystem_name(int subsystem);
+const char *mem_allocator(void);
+void mem_report(FILE *fp);
+
+// Update a buffer's capacity: 'tracked' holds the bytes accounted so far
+static inline void mem_update(int subsystem, int64_t *tracked, int64_t bytes) {
+    if (bytes == *tracked) return;
+    mem_add(subsystem, bytes - *tracked);
+    *tracked = bytes;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plugin.h"
+
+/*
+ * Load a plugin from 'path.so[:args]' and initialize it
+ * Returns -1 on error
+ */
+int plugin_load(plugin_t *p, const char *spec, sam_hdr_t *header) {
+    memset(p, 0, sizeof(plugin_t));
+    p->spec = strdup(spec);
+
+    // Split 'path:args'
+    char *path = strdup(spec);
+    if (!p->spec || !path) {
+        fprintf(stderr, "Error: Out of memory loading plugin '%s'\n", spec);
+        goto error;
+    }
+    char *args = strchr(path, ':');
+    if (args) *args++ = '\0';
+    else args = "";
+
+    if (!(p->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL))) {
+        fprintf(stderr, "Error loading plugin '%s': %s\n", path, dlerror());
+        goto error;
+    }
+
+    umi_plugin_info_f info = (umi_plugin_info_f) dlsym(p->handle, UMI_PLUGIN_ENTRY);
+    if (!info || !(p->info = info())) {
+        fprintf(stderr, "Error: Plugin '%s' does not export '%s'\n", path, UMI_PLUGIN_ENTRY);
+        goto error;
+    }
+    if (p->info->api_version != UMI_PLUGIN_API_VERSION) {
+        fprintf(stderr, "Error: Plugin '%s' has API version %d, expected %d\n", path, p->info->api_version, UMI_PLUGIN_API_VERSION);
+        goto error;
+    }
+    if (!p->info->process) {
+        fprintf(stderr, "Error: Plugin '%s' has no process function\n", path);
+        goto error;
+    }
+    if (p->info->init && !(p->state = p->info->init(args, header))) {
+        fprintf(stderr, "Error initializing plugin '%s' (%s), args '%s'\n", p->info->name, path, args);
+        goto error;
+    }
+
+    free(path);
+    return 0;
+
+error:
+    free(path);
+    free(p->spec);
+    if (p->handle) dlclose(p->handle);
+    memset(p, 0, sizeof(plugin_t));
+    return -1;
+}
+
+// Process a batch of records. Returns -1 on error
+int plugin_process(plugin_t *p, const sam_hdr_t *header, bam1_t **recs, int n) {
+    if (p->info->process(p->state, header, recs, n) < 0) {
+        fprintf(stderr, "Error in plugin '%s'\n", p->info->name);
+        return -1;
+    }
+    return 0;
+}
+
+void plugin_unload(plugin_t *p) {
+    if (p->info && p->info->destroy) p->info->destroy(p->state);
+    if (p->handle) dlclose(p->handle);
+    free(p->spec);
+    memset(p, 0, sizeof(plugin_t));
+}
@@ -0,0 +1,18 @@
+#ifndef UMI_RX_PLUGIN_H
+#define UMI_RX_PLUGIN_H
+
+#include "umi_plugin.h"
+
+// A loaded plugin
+typedef struct plugin_t {
+    char *spec;                 // 'path.so[:args]'
+    void *handle;               // dlopen handle
+    const umi_plugin_t *info;
+    void *state;
+} plugin_t;
+
+int plugin_load(plugin_t *p, const char *spec, sam_hdr_t *header);
+int plugin_process(plugin_t *p, const sam_hdr_t *header, bam1_t **recs, int n);
+void plugin_unload(plugin_t *p);
+
+#endif
@@ -0,0 +1,77 @@
+/*
+ * Example plugin: copy a field from the read name into a tag
+ *
+ * Args 'TAG:FIELD': the FIELD-th (1 based) ':' separated field of the read name is added as a 'Z' tag.
+ * E.g. add the flow cell lane from Illumina read names to 'LN':
+ *
+ *      umi_rx --plugin bin/plugins/name_field.so:LN:4 in.bam out.bam
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "umi_plugin.h"
+
+typedef struct name_field_t {
+    char tag[2];
+    int field;
+    long count;
+} name_field_t;
+
+static void *name_field_init(const char *args, sam_hdr_t *header) {
+    int field = 0;
+    if (strlen(args) < 4 || args[2] != ':' || (field = atoi(args + 3)) <= 0) {
+        fprintf(stderr, "Error: name_field plugin expects 'TAG:FIELD', got '%s'\n", args);
+        return NULL;
+    }
+    name_field_t *s = calloc(1, sizeof(name_field_t));
+    if (!s) return NULL;
+    memcpy(s->tag, args, 2);
+    s->field = field;
+    return s;
+}
+
+static int name_field_process(void *state, const sam_hdr_t *header, bam1_t **recs, int n) {
+    name_field_t *s = (name_field_t *) state;
+    for (int i = 0; i < n; i++) {
+        // Find field: skip 'field - 1' separators
+        const char *start = bam_get_qname(recs[i]);
+        for (int f = 1; start && f < s->field; f++) {
+            start = strchr(start, ':');
+            if (start) start++;
+        }
+        if (!start) continue;   // Not enough fields
+        const char *end = strchr(start, ':');
+        int len = end ? end - start : (int) strlen(start);
+
+        // Copy value: appending may reallocate the record's data (and the read name)
+        char value[256];
+        if (len >= (int) sizeof(value)) len = sizeof(value) - 1;
+        memcpy(value, start, len);
+        value[len] = '\0';
+
+        if (bam_aux_update_str(recs[i], s->tag, len + 1, value) < 0) return -1;
+        s->count++;
+    }
+    return 0;
+}
+
+static void name_field_destroy(void *state) {
+    name_field_t *s = (name_field_t *) state;
+    fprintf(stderr, "name_field: %ld '%.2s' tags added\n", s->count, s->tag);
+    free(s);
+}
+
+static const umi_plugin_t plugin = {
+    UMI_PLUGIN_API_VERSION,
+    "name_field",
+    0,
+    name_field_init,
+    name_field_process,
+    name_field_destroy
+};
+
+const umi_plugin_t *umi_plugin_info(void) {
+    return &plugin;
+}
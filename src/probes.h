@@ -0,0 +1,32 @@
+#ifndef UMI_RX_PROBES_H
+#define UMI_RX_PROBES_H
+
+/*
+ * USDT static probes (provider 'umi_rx'), enabled when built with UMI_RX_USDT
+ * ('USDT=1 script/make_c.sh', needs 'sys/sdt.h' from systemtap-sdt-dev).
+ * A probe is a single 'nop' until a tracer attaches, e.g.:
+ *
+ *      bpftrace -e 'usdt:bin/umi_rx:umi_rx:batch_read { @records = hist(arg1); }'
+ *
+ * Probes (arguments):
+ *      batch_read      first read number, records, BAM record bytes
+ *      batch_tagged    records kept, records rejected by the error policy
+ *      batch_written   records, BAM record bytes, output compressed offset
+ *      block_written   compressed bytes handed to BGZF since the previous batch, output compressed offset
+ *      name_group      records in the read name group (mate tags)
+ *      error           category (ERROR_*), read number
+ *
+ * Without UMI_RX_USDT the macros expand to nothing (arguments are not evaluated).
+ */
+#ifdef UMI_RX_USDT
+#include <sys/sdt.h>
+#define UMI_PROBE1(name, a) DTRACE_PROBE1(umi_rx, name, a)
+#define UMI_PROBE2(name, a, b) DTRACE_PROBE2(umi_rx, name, a, b)
+#define UMI_PROBE3(name, a, b, c) DTRACE_PROBE3(umi_rx, name, a, b, c)
+#else
+#define UMI_PROBE1(name, a) do {} while (0)
+#define UMI_PROBE2(name, a, b) do {} while (0)
+#define UMI_PROBE3(name, a, b, c) do {} while (0)
+#endif
+
+#endif
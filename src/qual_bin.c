@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qual_bin.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define QUAL_BIN_X86 1
+#endif
+
+#define SIMD_MAX_QUAL 63    // SIMD lookup table covers qualities [0, 63]
+
+/*
+ * Illumina 8-level binning (as used by RTA / bcl2fastq)
+ * Format: 'lower_bound:value' for each bin, bins are sorted by lower bound
+ */
+static const char *ILLUMINA_BINS = "0:0,2:6,10:15,20:22,25:27,30:33,35:37,40:40";
+
+/*
+ * Create binning table from a spec: either 'illumina' or a list of bins 'lower_bound:value,...'
+ * (e.g. '0:0,2:10,20:25,30:37'). Qualities below the first bound are not changed.
+ * Returns -1 on error
+ */
+int qual_bin_init(qual_bin_t *qb, const char *spec) {
+    for (int i = 0; i < 256; i++) qb->table[i] = i;
+    if (strcmp(spec, "illumina") == 0) spec = ILLUMINA_BINS;
+
+    const char *p = spec;
+    int prev = -1;
+    while (*p) {
+        char *end;
+        long lower = strtol(p, &end, 10);
+        if (*end != ':' || lower <= prev || lower > 254) goto error;
+        long value = strtol(end + 1, &end, 10);
+        if ((*end != ',' && *end != '\0') || value < 0 || value > 254) goto error;
+
+        // Qualities from 'lower' upwards (until the next bin) map to 'value'. Missing qualities (0xff) are kept
+        for (int q = lower; q < 255; q++) qb->table[q] = value;
+        prev = lower;
+        p = *end ? end + 1 : end;
+    }
+    if (prev < 0) goto error;
+
+#ifdef QUAL_BIN_X86
+    qb->simd = __builtin_cpu_supports("ssse3");
+#else
+    qb->simd = 0;
+#endif
+    return 0;
+
+error:
+    fprintf(stderr, "Error: Invalid quality binning '%s', expected 'illumina' or 'lower_bound:value,...'\n", spec);
+    return -1;
+}
+
+static inline void qual_bin_scalar(const qual_bin_t *qb, uint8_t *qual, int len) {
+    for (int i = 0; i < len; i++) qual[i] = qb->table[qual[i]];
+}
+
+#ifdef QUAL_BIN_X86
+/*
+ * SSSE3 lookup: the table for qualities [0, 63] is split in four 16 entry tables, each one
+ * looked up with 'pshufb' on the low nibble and selected by the high nibble.
+ * Blocks having qualities above 63 fall back to the scalar lookup.
+ */
+__attribute__((target("ssse3")))
+static void qual_bin_ssse3(const qual_bin_t *qb, uint8_t *qual, int len) {
+    const __m128i t0 = _mm_loadu_si128((const __m128i *) (qb->table + 0));
+    const __m128i t1 = _mm_loadu_si128((const __m128i *) (qb->table + 16));
+    const __m128i t2 = _mm_loadu_si128((const __m128i *) (qb->table + 32));
+    const __m128i t3 = _mm_loadu_si128((const __m128i *) (qb->table + 48));
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i max_qual = _mm_set1_epi8(SIMD_MAX_QUAL);
+    const __m128i zero = _mm_setzero_si128();
+
+    int i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i q = _mm_loadu_si128((const __m128i *) (qual + i));
+
+        // Any quality above 63 in this block?
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(q, max_qual), zero)) != 0xffff) {
+            qual_bin_scalar(qb, qual + i, 16);
+            continue;
+        }
+
+        __m128i lo = _mm_and_si128(q, nibble);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(q, 4), nibble);
+        __m128i r = _mm_and_si128(_mm_cmpeq_epi8(hi, _mm_set1_epi8(0)), _mm_shuffle_epi8(t0, lo));
+        r = _mm_or_si128(r, _mm_and_si128(_mm_cmpeq_epi8(hi, _mm_set1_epi8(1)), _mm_shuffle_epi8(t1, lo)));
+        r = _mm_or_si128(r, _mm_and_si128(_mm_cmpeq_epi8(hi, _mm_set1_epi8(2)), _mm_shuffle_epi8(t2, lo)));
+        r = _mm_or_si128(r, _mm_and_si128(_mm_cmpeq_epi8(hi, _mm_set1_epi8(3)), _mm_shuffle_epi8(t3, lo)));
+        _mm_storeu_si128((__m128i *) (qual + i), r);
+    }
+
+    qual_bin_scalar(qb, qual + i, len - i);
+}
+#endif
+
+// Bin qualities in place
+void qual_bin_apply(const qual_bin_t *qb, uint8_t *qual, int len) {
+    if (len <= 0 || qual[0] == 0xff) return; // Missing qualities
+#ifdef QUAL_BIN_X86
+    if (qb->simd) {
+        qual_bin_ssse3(qb, qual, len);
+        return;
+    }
+#endif
+    qual_bin_scalar(qb, qual, len);
+}
@@ -0,0 +1,18 @@
+#ifndef UMI_RX_QUAL_BIN_H
+#define UMI_RX_QUAL_BIN_H
+
+#include <stdint.h>
+
+/*
+ * Quality score binning: maps each base quality (Phred value) to its bin value.
+ * Binned qualities compress much better than raw ones.
+ */
+typedef struct qual_bin_t {
+    uint8_t table[256];
+    int simd;           // Use SIMD (SSSE3) lookup
+} qual_bin_t;
+
+int qual_bin_init(qual_bin_t *qb, const char *spec);
+void qual_bin_apply(const qual_bin_t *qb, uint8_t *qual, int len);
+
+#endif
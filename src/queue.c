@@ -0,0 +1,73 @@
+#include <stdlib.h>
+
+#include "queue.h"
+
+queue_t *queue_init(int size) {
+    queue_t *q = calloc(1, sizeof(queue_t));
+    if (!q) return NULL;
+    q->items = calloc(size, sizeof(void *));
+    if (!q->items) {
+        free(q);
+        return NULL;
+    }
+    q->size = size;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    return q;
+}
+
+void queue_destroy(queue_t *q) {
+    if (!q) return;
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+    free(q->items);
+    free(q);
+}
+
+// Add an item, blocks while the queue is full. Returns -1 if the queue was closed
+int queue_push(queue_t *q, void *item) {
+    pthread_mutex_lock(&q->lock);
+    while (q->n == q->size && !q->closed) pthread_cond_wait(&q->not_full, &q->lock);
+    if (q->closed) {
+        pthread_mutex_unlock(&q->lock);
+        return -1;
+    }
+    q->items[(q->head + q->n) % q->size] = item;
+    q->n++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+// Remove an item, blocks while the queue is empty. Returns NULL when the queue is closed and empty
+void *queue_pop(queue_t *q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->n == 0 && !q->closed) pthread_cond_wait(&q->not_empty, &q->lock);
+    void *item = NULL;
+    if (q->n > 0) {
+        item = q->items[q->head];
+        q->head = (q->head + 1) % q->size;
+        q->n--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+// No more items will be added: wake up all waiting threads
+void queue_close(queue_t *q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+}
+
+int queue_depth(queue_t *q) {
+    pthread_mutex_lock(&q->lock);
+    int n = q->n;
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
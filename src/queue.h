@@ -0,0 +1,29 @@
+#ifndef UMI_RX_QUEUE_H
+#define UMI_RX_QUEUE_H
+
+#include <pthread.h>
+
+/*
+ * Bounded blocking queue used to pass batches between pipeline threads.
+ *
+ * Closing a queue wakes up all waiting threads: 'queue_push' fails and
+ * 'queue_pop' returns NULL once the queue is closed and drained.
+ */
+typedef struct queue_t {
+    void **items;
+    int size;           // Capacity
+    int head;           // Index of the next item to pop
+    int n;              // Number of items in the queue
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+} queue_t;
+
+queue_t *queue_init(int size);
+void queue_destroy(queue_t *q);
+int queue_push(queue_t *q, void *item);
+void *queue_pop(queue_t *q);
+void queue_close(queue_t *q);
+int queue_depth(queue_t *q);
+
+#endif
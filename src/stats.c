@@ -0,0 +1,303 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "mem.h"
+#include "stats.h"
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+static const char *stage_names[STAGE_N] = {"read", "tag", "write"};
+
+static int stats_signal_fd = -1;            // Server pipe, written by the signal handler
+static struct sigaction stats_old_action;   // Restored when the server stops
+
+void stats_init(stats_t *s) {
+    memset(s, 0, sizeof(stats_t));
+    clock_gettime(CLOCK_MONOTONIC, &s->start);
+}
+
+// Copy tag counters (tag stage only)
+void stats_publish_tags(stats_t *s, const tagger_t *t) {
+    tag_stats_t *ts = &s->tags;
+    STORE(ts->mc, t->mate.count_mc);
+    STORE(ts->mq, t->mate.count_mq);
+    STORE(ts->ms, t->mate.count_ms);
+    STORE(ts->fixmate, t->mate.count_fixmate);
+    STORE(ts->removed, t->count_removed);
+    STORE(ts->filtered, t->filter.count_filtered);
+    for (int i = 0; i < ERROR_NCATEGORIES; i++) STORE(ts->errors[i], t->count_errors[i]);
+}
+
+// Resident set size in bytes, -1 if not available
+static long rss_bytes(void) {
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp) return -1;
+    long size, rss;
+    int ok = fscanf(fp, "%ld %ld", &size, &rss) == 2;
+    fclose(fp);
+    return ok ? rss * sysconf(_SC_PAGESIZE) : -1;
+}
+
+// Peak resident set size in bytes
+static long rss_peak_bytes(void) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) < 0) return -1;
+    return ru.ru_maxrss * 1024L;  // Linux: kilobytes
+}
+
+static double stats_elapsed(const stats_t *s) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - s->start.tv_sec) + (now.tv_nsec - s->start.tv_nsec) / 1e9;
+    return elapsed > 0 ? elapsed : 1e-9;
+}
+
+// Current stats as a JSON object (one line). Only reads counters, never blocks the pipeline
+int stats_json(engine_t *e, kstring_t *str) {
+    stats_t *s = &e->stats;
+    double elapsed = stats_elapsed(s);
+
+    int err = ksprintf(str, "{\"elapsed_s\": %.3f, \"stages\": {", elapsed) < 0;
+    for (int i = 0; i < STAGE_N; i++) {
+        long records = LOAD(s->stage[i].records);
+        err |= ksprintf(str, "%s\"%s\": {\"records\": %ld, \"batches\": %ld, \"records_per_s\": %.1f, \"busy_s\": %.3f}", i ? ", " : "", stage_names[i], records, LOAD(s->stage[i].batches), records / elapsed, LOAD(s->stage[i].busy_ns) / 1e9) < 0;
+    }
+
+    tag_stats_t *t = &s->tags;
+    err |= ksprintf(str, "}, \"tags\": {\"mc\": %ld, \"mq\": %ld, \"ms\": %ld, \"fixmate\": %ld, \"removed\": %ld}, \"filtered\": %ld, \"errors\": {\"no_umi\": %ld, \"bad_tags\": %ld}",
+                    LOAD(t->mc), LOAD(t->mq), LOAD(t->ms), LOAD(t->fixmate), LOAD(t->removed), LOAD(t->filtered), LOAD(t->errors[ERROR_NO_UMI]), LOAD(t->errors[ERROR_BAD_TAGS])) < 0;
+
+    int64_t offset = LOAD(s->stage[STAGE_READ].offset);
+    err |= ksprintf(str, ", \"queues\": {\"read\": %d, \"tagged\": %d, \"free\": %d}, \"rss_bytes\": %ld, \"rss_peak_bytes\": %ld, \"input_offset\": {\"virtual\": %lld, \"compressed\": %lld}}\n",
+                    queue_depth(e->q_read), queue_depth(e->q_tagged), queue_depth(e->q_empty), rss_bytes(), rss_peak_bytes(), (long long) offset, (long long) (offset >> 16)) < 0;
+    return err ? -1 : 0;
+}
+
+// Prometheus metric header
+static int metric(kstring_t *str, const char *name, const char *type, const char *help) {
+    return ksprintf(str, "# HELP umi_rx_%s %s\n# TYPE umi_rx_%s %s\n", name, help, name, type) < 0;
+}
+
+// Uncompressed / compressed bytes, 0 if unknown (e.g. SAM)
+static double ratio(int64_t uncompressed, int64_t compressed) {
+    return compressed > 0 ? (double) uncompressed / compressed : 0;
+}
+
+// Current stats in Prometheus text format
+int stats_prometheus(engine_t *e, kstring_t *str, int finished) {
+    stats_t *s = &e->stats;
+    tag_stats_t *t = &s->tags;
+    double elapsed = stats_elapsed(s);
+    long reads = LOAD(s->stage[STAGE_READ].records);
+    int64_t in_raw = LOAD(s->stage[STAGE_READ].bytes), out_raw = LOAD(s->stage[STAGE_WRITE].bytes);
+    int64_t in_bytes = LOAD(s->stage[STAGE_READ].offset) >> 16, out_bytes = LOAD(s->stage[STAGE_WRITE].offset) >> 16;
+
+    int err = metric(str, "reads_total", "counter", "Records read");
+    err |= ksprintf(str, "umi_rx_reads_total %ld\n", reads) < 0;
+    err |= metric(str, "reads_per_second", "gauge", "Records read per second (average since start)");
+    err |= ksprintf(str, "umi_rx_reads_per_second %.1f\n", reads / elapsed) < 0;
+    err |= metric(str, "written_total", "counter", "Records written");
+    err |= ksprintf(str, "umi_rx_written_total %ld\n", LOAD(s->stage[STAGE_WRITE].records)) < 0;
+
+    err |= metric(str, "bytes_total", "counter", "Compressed bytes read / written (BGZF files only)");
+    err |= ksprintf(str, "umi_rx_bytes_total{direction=\"in\"} %" PRId64 "\numi_rx_bytes_total{direction=\"out\"} %" PRId64 "\n", in_bytes, out_bytes) < 0;
+    err |= metric(str, "uncompressed_bytes_total", "counter", "BAM record bytes read / written");
+    err |= ksprintf(str, "umi_rx_uncompressed_bytes_total{direction=\"in\"} %" PRId64 "\numi_rx_uncompressed_bytes_total{direction=\"out\"} %" PRId64 "\n", in_raw, out_raw) < 0;
+    err |= metric(str, "compression_ratio", "gauge", "Uncompressed / compressed bytes, 0 if unknown");
+    err |= ksprintf(str, "umi_rx_compression_ratio{direction=\"in\"} %.3f\numi_rx_compression_ratio{direction=\"out\"} %.3f\n", ratio(in_raw, in_bytes), ratio(out_raw, out_bytes)) < 0;
+
+    err |= metric(str, "stage_busy_seconds_total", "counter", "Time each pipeline stage spent processing (not waiting on queues)");
+    for (int i = 0; i < STAGE_N; i++)
+        err |= ksprintf(str, "umi_rx_stage_busy_seconds_total{stage=\"%s\"} %.3f\n", stage_names[i], LOAD(s->stage[i].busy_ns) / 1e9) < 0;
+    err |= metric(str, "queue_depth", "gauge", "Batches waiting in each pipeline queue");
+    err |= ksprintf(str, "umi_rx_queue_depth{queue=\"read\"} %d\numi_rx_queue_depth{queue=\"tagged\"} %d\numi_rx_queue_depth{queue=\"free\"} %d\n", queue_depth(e->q_read), queue_depth(e->q_tagged), queue_depth(e->q_empty)) < 0;
+
+    err |= metric(str, "errors_total", "counter", "Malformed records by category");
+    err |= ksprintf(str, "umi_rx_errors_total{category=\"no_umi\"} %ld\numi_rx_errors_total{category=\"bad_tags\"} %ld\n", LOAD(t->errors[ERROR_NO_UMI]), LOAD(t->errors[ERROR_BAD_TAGS])) < 0;
+    err |= metric(str, "filtered_total", "counter", "Records dropped by filters");
+    err |= ksprintf(str, "umi_rx_filtered_total %ld\n", LOAD(t->filtered)) < 0;
+
+    err |= metric(str, "resident_memory_bytes", "gauge", "Resident set size");
+    err |= ksprintf(str, "umi_rx_resident_memory_bytes %ld\n", rss_bytes()) < 0;
+    err |= metric(str, "peak_memory_bytes", "gauge", "Peak resident set size");
+    err |= ksprintf(str, "umi_rx_peak_memory_bytes %ld\n", rss_peak_bytes()) < 0;
+    err |= metric(str, "buffer_peak_bytes", "gauge", "Peak bytes of the tool's own buffers, by subsystem");
+    for (int i = 0; i < MEM_N; i++)
+        err |= ksprintf(str, "umi_rx_buffer_peak_bytes{subsystem=\"%s\"} %" PRId64 "\n", mem_subsystem_name(i), mem_peak(i)) < 0;
+    err |= metric(str, "elapsed_seconds", "gauge", "Seconds since the run started");
+    err |= ksprintf(str, "umi_rx_elapsed_seconds %.3f\n", elapsed) < 0;
+    err |= metric(str, "finished", "gauge", "1 if the run finished");
+    err |= ksprintf(str, "umi_rx_finished %d\n", finished) < 0;
+    return err ? -1 : 0;
+}
+
+// Write metrics atomically (temporary file and rename), as expected by node exporter's textfile collector
+int stats_write_metrics(engine_t *e, const char *path, int finished) {
+    kstring_t str = KS_INITIALIZE, tmp = KS_INITIALIZE;
+    int ret = -1;
+    if (ksprintf(&tmp, "%s.tmp", path) < 0 || stats_prometheus(e, &str, finished) < 0) goto done;
+
+    FILE *fp = fopen(tmp.s, "w");
+    if (!fp) goto done;
+    int ok = fwrite(str.s, 1, str.l, fp) == str.l;
+    if (fclose(fp) != 0) ok = 0;
+    if (ok && rename(tmp.s, path) == 0) ret = 0;
+    else unlink(tmp.s);
+
+done:
+    if (ret < 0) fprintf(stderr, "Error writing metrics \"%s\"\n", path);
+    ks_free(&str);
+    ks_free(&tmp);
+    return ret;
+}
+
+// Only async-signal-safe calls: wake up the server thread
+static void stats_signal_handler(int sig) {
+    int saved_errno = errno;
+    if (stats_signal_fd >= 0 && write(stats_signal_fd, "s", 1) < 0) {
+        // Pipe full: a dump is already pending
+    }
+    errno = saved_errno;
+}
+
+static void *stats_server_thread(void *arg) {
+    stats_server_t *srv = (stats_server_t *) arg;
+    struct pollfd fds[2] = {{srv->pipe[0], POLLIN, 0}, {srv->sock, POLLIN, 0}};
+    int nfds = srv->sock >= 0 ? 2 : 1;
+    kstring_t str = KS_INITIALIZE;
+    int64_t every_ns = (int64_t) srv->metrics_every * 1000000000;
+    int64_t next_metrics = stats_now_ns() + every_ns;
+    for (;;) {
+        // Metrics file: wake up when it is due
+        int timeout = -1;
+        if (srv->metrics_file) {
+            int64_t now = stats_now_ns();
+            if (now >= next_metrics) {
+                stats_write_metrics(srv->engine, srv->metrics_file, 0);
+                next_metrics = now + every_ns;
+            }
+            timeout = (int) ((next_metrics - now + 999999) / 1000000);
+        }
+
+        if (poll(fds, nfds, timeout) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        // Signal: stats to stderr. 'q': stop
+        if (fds[0].revents & POLLIN) {
+            char c;
+            if (read(srv->pipe[0], &c, 1) != 1 || c == 'q') break;
+            str.l = 0;
+            if (stats_json(srv->engine, &str) == 0) {
+                fputc('\n', stderr);
+                fputs(str.s, stderr);
+                fflush(stderr);
+            }
+        }
+
+        // Socket: stats to the client
+        if (nfds > 1 && (fds[1].revents & POLLIN)) {
+            int fd = accept(srv->sock, NULL, NULL);
+            if (fd < 0) continue;
+            str.l = 0;
+            if (stats_json(srv->engine, &str) == 0 && send(fd, str.s, str.l, MSG_NOSIGNAL) < 0) {
+                // Client went away, nothing to do
+            }
+            close(fd);
+        }
+    }
+    ks_free(&str);
+    return NULL;
+}
+
+static void stats_server_close(stats_server_t *srv) {
+    if (srv->handle_signal) {
+        sigaction(SIGUSR1, &stats_old_action, NULL);
+        stats_signal_fd = -1;
+        srv->handle_signal = 0;
+    }
+    if (srv->sock >= 0) {
+        close(srv->sock);
+        unlink(srv->socket_path);
+        srv->sock = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (srv->pipe[i] >= 0) close(srv->pipe[i]);
+        srv->pipe[i] = -1;
+    }
+}
+
+/*
+ * Start the stats server, as set in the engine: stats on SIGUSR1, on connections
+ * to a Unix socket and / or a periodic metrics file.
+ * Does nothing if none is enabled. Returns -1 on error
+ */
+int stats_server_start(stats_server_t *srv, engine_t *e) {
+    const char *socket_path = e->stats_socket;
+    int handle_signal = e->stats_signal;
+    memset(srv, 0, sizeof(stats_server_t));
+    srv->engine = e;
+    srv->socket_path = socket_path;
+    srv->metrics_file = e->metrics_file;
+    srv->metrics_every = e->metrics_every > 0 ? e->metrics_every : STATS_METRICS_EVERY;
+    srv->sock = srv->pipe[0] = srv->pipe[1] = -1;
+    if (!socket_path && !handle_signal && !srv->metrics_file) return 0;
+
+    if (pipe(srv->pipe) < 0) goto fail;
+    fcntl(srv->pipe[1], F_SETFL, O_NONBLOCK);  // The signal handler must never block
+
+    if (socket_path) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(socket_path) >= sizeof(addr.sun_path)) goto fail_socket;
+        strcpy(addr.sun_path, socket_path);
+        unlink(socket_path);
+        if ((srv->sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) goto fail_socket;
+        if (bind(srv->sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(srv->sock, 8) < 0) goto fail_socket;
+    }
+
+    if (handle_signal) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = stats_signal_handler;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;
+        stats_signal_fd = srv->pipe[1];
+        if (sigaction(SIGUSR1, &sa, &stats_old_action) < 0) goto fail;
+        srv->handle_signal = 1;
+    }
+
+    if (pthread_create(&srv->thread, NULL, stats_server_thread, srv) != 0) goto fail;
+    srv->running = 1;
+    return 0;
+
+fail_socket:
+    fprintf(stderr, "Error creating stats socket \"%s\"\n", socket_path);
+fail:
+    stats_server_close(srv);
+    return -1;
+}
+
+void stats_server_stop(stats_server_t *srv) {
+    if (srv->running) {
+        while (write(srv->pipe[1], "q", 1) < 0 && errno == EAGAIN) usleep(1000);
+        pthread_join(srv->thread, NULL);
+        srv->running = 0;
+    }
+    if (srv->metrics_file) stats_write_metrics(srv->engine, srv->metrics_file, !srv->engine->error);
+    stats_server_close(srv);
+}
@@ -0,0 +1,88 @@
+#ifndef UMI_RX_STATS_H
+#define UMI_RX_STATS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "htslib/kstring.h"
+
+#include "tagger.h"
+
+#define STATS_CACHE_LINE 64
+#define STATS_METRICS_EVERY 15  // Default seconds between metrics files
+
+// Pipeline stages
+#define STAGE_READ 0
+#define STAGE_TAG 1
+#define STAGE_WRITE 2
+#define STAGE_N 3
+
+/*
+ * Live counters: each stage updates its own cache line (no false sharing,
+ * no locks), values are only read and aggregated when stats are requested.
+ */
+typedef struct stage_stats_t {
+    long records;               // Records processed by the stage
+    long batches;               // Batches processed by the stage
+    int64_t bytes;              // Read / write stages: uncompressed record bytes
+    int64_t busy_ns;            // Time spent processing (not waiting on queues)
+    int64_t offset;             // Read / write stages: input / output virtual offset
+} __attribute__((aligned(STATS_CACHE_LINE))) stage_stats_t;
+
+// Tag counters, published by the tag stage after each batch
+typedef struct tag_stats_t {
+    long mc, mq, ms, fixmate;
+    long removed, filtered;
+    long errors[ERROR_NCATEGORIES];
+} __attribute__((aligned(STATS_CACHE_LINE))) tag_stats_t;
+
+typedef struct stats_t {
+    stage_stats_t stage[STAGE_N];
+    tag_stats_t tags;
+    struct timespec start;
+} stats_t;
+
+struct engine_t;
+
+/*
+ * Stats server: a thread waiting for SIGUSR1 (stats are written to stderr)
+ * or for connections on a Unix domain socket (stats are written to the client).
+ * Stats are one JSON object per request, the pipeline never waits for the server.
+ * The same thread writes the Prometheus metrics file periodically.
+ */
+typedef struct stats_server_t {
+    struct engine_t *engine;
+    const char *socket_path;    // NULL for none
+    int sock;                   // Listening socket, -1 for none
+    int pipe[2];                // Wakes up the server (signal handler, stop)
+    int handle_signal;          // Install SIGUSR1 handler
+    const char *metrics_file;   // Prometheus textfile, NULL for none
+    int metrics_every;          // Seconds between metrics files
+    pthread_t thread;
+    int running;
+} stats_server_t;
+
+static inline int64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Single writer per counter: relaxed stores are enough for readers on other threads
+static inline void stage_stats_add(stage_stats_t *s, long records, int64_t bytes, int64_t busy_ns) {
+    __atomic_store_n(&s->records, s->records + records, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->batches, s->batches + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->bytes, s->bytes + bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->busy_ns, s->busy_ns + busy_ns, __ATOMIC_RELAXED);
+}
+
+void stats_init(stats_t *s);
+void stats_publish_tags(stats_t *s, const tagger_t *t);
+int stats_json(struct engine_t *e, kstring_t *str);
+int stats_prometheus(struct engine_t *e, kstring_t *str, int finished);
+int stats_write_metrics(struct engine_t *e, const char *path, int finished);
+int stats_server_start(stats_server_t *srv, struct engine_t *e);
+void stats_server_stop(stats_server_t *srv);
+
+#endif
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "probes.h"
+#include "tagger.h"
+#include "umi_rx.h"
+
+void tagger_init(tagger_t *t) {
+    memset(t, 0, sizeof(tagger_t));
+    mate_tags_init(&t->mate, 0, 0);
+}
+
+void tagger_destroy(tagger_t *t) {
+    mate_tags_destroy(&t->mate);
+    read_filter_destroy(&t->filter);
+}
+
+// Copy options, with empty buffers and counters. Clones can't filter records
+void tagger_clone(tagger_t *dst, const tagger_t *src) {
+    memcpy(dst, src, sizeof(tagger_t));
+    memset(&dst->filter, 0, sizeof(read_filter_t));
+    mate_tags_init(&dst->mate, src->mate.calc_mc, src->mate.calc_mq);
+    dst->mate.calc_ms = src->mate.calc_ms;
+    dst->mate.fixmate = src->mate.fixmate;
+    dst->count_removed = 0;
+    memset(dst->count_errors, 0, sizeof(dst->count_errors));
+}
+
+// Add counters from 'src' to 'dst' and reset them in 'src'
+void tagger_merge_counts(tagger_t *dst, tagger_t *src) {
+    dst->count_removed += src->count_removed;
+    dst->filter.count_filtered += src->filter.count_filtered;
+    dst->mate.count_mc += src->mate.count_mc;
+    dst->mate.count_mq += src->mate.count_mq;
+    dst->mate.count_ms += src->mate.count_ms;
+    dst->mate.count_fixmate += src->mate.count_fixmate;
+    for (int i = 0; i < ERROR_NCATEGORIES; i++) {
+        dst->count_errors[i] += src->count_errors[i];
+        src->count_errors[i] = 0;
+    }
+    src->count_removed = src->filter.count_filtered = 0;
+    src->mate.count_mc = src->mate.count_mq = src->mate.count_ms = src->mate.count_fixmate = 0;
+}
+
+/*
+ * Drop filtered records: kept records are moved to the beginning of 'recs'
+ * (dropped ones are left at the end). The input record number of each kept record
+ * is stored in 'read_nums' ('first_read' is the number of the first record),
+ * so messages refer to the input record. Returns the number of records kept, -1 on error
+ */
+int tagger_filter(tagger_t *t, const sam_hdr_t *header, bam1_t **recs, int n, long first_read, long *read_nums) {
+    if (!read_filter_active(&t->filter)) {
+        for (int i = 0; i < n; i++) read_nums[i] = first_read + i;
+        return n;
+    }
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        int ret = read_filter_pass(&t->filter, header, recs[i]);
+        if (ret < 0) {
+            fprintf(stderr, "Error evaluating filter expression, read_number=%ld, read_name='%s'\n", first_read + i, bam_get_qname(recs[i]));
+            return -1;
+        }
+        if (!ret) continue;
+        bam1_t *tmp = recs[kept];
+        read_nums[kept] = first_read + i;
+        recs[kept++] = recs[i];
+        recs[i] = tmp;
+    }
+    return kept;
+}
+
+/*
+ * Parse an error policy: 'abort', 'skip', 'pass' or 'reject:FILE'.
+ * For 'reject', the file name is stored in 'reject_file'. Returns -1 on error
+ */
+int tagger_on_error(tagger_t *t, const char *policy, const char **reject_file) {
+    if (strcmp(policy, "abort") == 0) t->on_error = ON_ERROR_ABORT;
+    else if (strcmp(policy, "skip") == 0) t->on_error = ON_ERROR_SKIP;
+    else if (strcmp(policy, "pass") == 0) t->on_error = ON_ERROR_PASS;
+    else if (strncmp(policy, "reject:", 7) == 0 && policy[7]) {
+        t->on_error = ON_ERROR_REJECT;
+        *reject_file = policy + 7;
+    } else {
+        fprintf(stderr, "Error: Unknown error policy '%s', expected 'abort', 'skip', 'pass' or 'reject:FILE'\n", policy);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Malformed record (out of the hot loop): count it and apply the error policy.
+ * Returns -1 to abort, 1 to drop the record, 0 to keep it untagged
+ */
+static __attribute__((cold, noinline)) int tag_error(tagger_t *t, const sam_hdr_t *header, bam1_t *aln, long read_num, int category) {
+    static const char *messages[ERROR_NCATEGORIES] = {"Could not find UMI from read name", "Malformed tags"};
+    int fatal = t->on_error == ON_ERROR_ABORT;
+    UMI_PROBE2(error, category, read_num);
+    if (fatal || t->count_errors[category]++ == 0) {
+        const char *chr = aln->core.tid >= 0 ? header->target_name[aln->core.tid] : "*";
+        fprintf(stderr, "%s: %s, read_number=%ld, chr='%s', pos=%ld, read_name='%s'%s\n", fatal ? "Error" : "Warning", messages[category], read_num, chr, (long) aln->core.pos + 1, bam_get_qname(aln), fatal ? "" : " (further records are only counted)");
+    }
+    if (fatal) return -1;
+    return t->on_error == ON_ERROR_PASS ? 0 : 1;
+}
+
+/*
+ * Remove unwanted tags, bin qualities and add UMI from read name to 'RX' tag (unless there is one).
+ * Returns 1 if the record is dropped by the error policy, -1 on error
+ * 'filter_tags' and 'bin_quals' are compile time constants in each specialization (see TAG_BATCH)
+ */
+static inline __attribute__((always_inline)) int tag_read(tagger_t *t, const sam_hdr_t *header, bam1_t *aln, long read_num, const int filter_tags, const int bin_quals) {
+    // Remove tags first: 'RX' is usually appended without reallocating
+    if (filter_tags != FILTER_TAGS_NONE) {
+        int removed = aux_filter_tags(aln, &t->tags, filter_tags == FILTER_TAGS_KEEP);
+        if (__builtin_expect(removed < 0, 0)) return tag_error(t, header, aln, read_num, ERROR_BAD_TAGS);
+        t->count_removed += removed;
+    }
+
+    if (bin_quals) qual_bin_apply(&t->qual_bin, bam_get_qual(aln), aln->core.l_qseq);
+
+    // Already tagged (e.g. a second pass): keep the existing RX, as the Java version
+    if (__builtin_expect(bam_aux_get(aln, "RX") != NULL, 0)) return 0;
+
+    char *read_name = bam_get_qname(aln);
+    char *umi = umi_from_name(read_name);
+    if (__builtin_expect(!umi, 0)) return tag_error(t, header, aln, read_num, ERROR_NO_UMI);
+
+    if (bam_aux_append(aln, "RX", 'Z', strlen(umi) + 1, (uint8_t *) umi) < 0) {
+        fprintf(stderr, "Error updating RX tag");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Tag a batch: 'RX' and, when there are mate tags, the mate tag loop on each run of records
+ * with the same name. Records dropped by the error policy are moved to the end.
+ * Returns the number of records kept
+ */
+static inline __attribute__((always_inline)) int tag_batch(tagger_t *t, const sam_hdr_t *header, bam1_t **recs, int n, const long *read_nums, const int filter_tags, const int bin_quals) {
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        int ret = tag_read(t, header, recs[i], read_nums[i], filter_tags, bin_quals);
+        if (__builtin_expect(ret != 0, 0)) {
+            if (ret < 0) return -1;
+            continue;
+        }
+        bam1_t *tmp = recs[kept];
+        recs[kept++] = recs[i];
+        recs[i] = tmp;
+    }
+    n = kept;
+
+    mate_group_f mate_group = t->mate_group;
+    if (!mate_group) return n;
+    for (int i = 0, j; i < n; i = j) {
+        for (j = i + 1; j < n && strcmp(bam_get_qname(recs[j]), bam_get_qname(recs[i])) == 0; j++);
+        if (mate_group(&t->mate, recs + i, j - i) < 0) {
+            fprintf(stderr, "Error adding mate tags, read_name='%s'\n", bam_get_qname(recs[i]));
+            return -1;
+        }
+    }
+    return n;
+}
+
+/*
+ * One specialization for each combination of record options: the per-record loop has
+ * no option checks. The mate tag loop is specialized for each tag set in 'mate.c'.
+ * Both are chosen once by 'tagger_prepare'
+ */
+#define TAG_BATCH(filter_tags, bin_quals) \
+    static int tag_batch_##filter_tags##_##bin_quals(tagger_t *t, const sam_hdr_t *header, bam1_t **recs, int n, const long *read_nums) { \
+        return tag_batch(t, header, recs, n, read_nums, filter_tags, bin_quals); \
+    }
+
+#define TAG_BATCH_ALL(filter_tags) \
+    TAG_BATCH(filter_tags, 0) \
+    TAG_BATCH(filter_tags, 1)
+
+TAG_BATCH_ALL(0)    // FILTER_TAGS_NONE
+TAG_BATCH_ALL(1)    // FILTER_TAGS_REMOVE
+TAG_BATCH_ALL(2)    // FILTER_TAGS_KEEP
+
+#define TAG_BATCH_ENTRY(filter_tags) \
+    {tag_batch_##filter_tags##_0, tag_batch_##filter_tags##_1}
+
+// Indexed by [filter_tags][bin_quals]
+static const tag_batch_f tag_batch_table[3][2] = {
+    TAG_BATCH_ENTRY(0),
+    TAG_BATCH_ENTRY(1),
+    TAG_BATCH_ENTRY(2)
+};
+
+// Choose the tagging loops for the current options. Must be called after all options are set
+void tagger_prepare(tagger_t *t) {
+    t->tag_batch = tag_batch_table[t->filter_tags][t->bin_quals != 0];
+    t->mate_group = mate_tags_select(&t->mate);
+}
+
+/*
+ * Tag records: 'RX' and, when enabled, mate tags on each run of records with the same name.
+ * Read name groups must not be split across calls. 'read_nums' are the input record
+ * numbers (from 'tagger_filter'). Records dropped by the error policy
+ * are moved to the end of 'recs'. Returns the number of records kept, -1 on error
+ */
+int tagger_tag(tagger_t *t, const sam_hdr_t *header, bam1_t **recs, int n, const long *read_nums) {
+    if (!t->tag_batch) tagger_prepare(t);
+    return t->tag_batch(t, header, recs, n, read_nums);
+}
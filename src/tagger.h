@@ -0,0 +1,64 @@
+#ifndef UMI_RX_TAGGER_H
+#define UMI_RX_TAGGER_H
+
+#include "htslib/sam.h"
+
+#include "filter.h"
+#include "mate.h"
+#include "qual_bin.h"
+#include "tags.h"
+
+#define FILTER_TAGS_NONE 0
+#define FILTER_TAGS_REMOVE 1
+#define FILTER_TAGS_KEEP 2
+
+// What to do with malformed records
+#define ON_ERROR_ABORT 0        // Stop with an error (default)
+#define ON_ERROR_SKIP 1         // Drop the record
+#define ON_ERROR_PASS 2         // Keep the record, without 'RX' tag
+#define ON_ERROR_REJECT 3       // Drop the record, the engine writes it to a reject file
+
+// Malformed record categories
+#define ERROR_NO_UMI 0          // No ':' in the read name
+#define ERROR_BAD_TAGS 1        // Tags could not be parsed
+#define ERROR_NCATEGORIES 2
+
+/*
+ * Per-record work of the default mode: filter records, remove tags, bin
+ * qualities, add 'RX' and mate tags. Used by the 'umi_rx' engine and by libumirx.
+ *
+ * Clones share the options (not the filter) but have their own buffers and
+ * counters, so several threads can tag different batches at the same time.
+ */
+struct tagger_t;
+typedef int (*tag_batch_f)(struct tagger_t *t, const sam_hdr_t *header, bam1_t **recs, int n, const long *read_nums);
+
+typedef struct tagger_t {
+    read_filter_t filter;   // Records to drop
+    mate_tags_t mate;
+    tag_set_t tags;         // Tags to remove / keep
+    int filter_tags;        // One of FILTER_TAGS_*
+    qual_bin_t qual_bin;    // Quality score binning
+    int bin_quals;
+    long count_removed;     // Number of tags removed
+    int on_error;           // One of ON_ERROR_*
+    long count_errors[ERROR_NCATEGORIES];  // Malformed records, by category
+    tag_batch_f tag_batch;  // Tagging loop specialized for these options (see 'tagger_prepare')
+    mate_group_f mate_group;    // Mate tag loop specialized for the tag set, NULL for none
+} tagger_t;
+
+// Do records need to be processed by read name?
+static inline int tagger_grouped(const tagger_t *t) {
+    return t->mate.calc_mc || t->mate.calc_mq || t->mate.calc_ms || t->mate.fixmate;
+}
+
+void tagger_init(tagger_t *t);
+void tagger_destroy(tagger_t *t);
+void tagger_clone(tagger_t *dst, const tagger_t *src);
+void tagger_merge_counts(tagger_t *dst, tagger_t *src);
+void tagger_prepare(tagger_t *t);
+int tagger_on_error(tagger_t *t, const char *policy, const char **reject_file);
+int tagger_filter(tagger_t *t, const sam_hdr_t *header, bam1_t **recs, int n, long first_read, long *read_nums);
+int tagger_tag(tagger_t *t, const sam_hdr_t *header, bam1_t **recs, int n, const long *read_nums);
+
+#endif
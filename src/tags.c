@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "tags.h"
+
+/*
+ * Parse a comma separated list of tags (e.g. "RX,QX,OX") into a tag set.
+ * A '*' matches any second character, e.g. "X*"
+ * Returns -1 on error
+ */
+int tag_set_parse(tag_set_t *t, const char *list) {
+    memset(t, 0, sizeof(tag_set_t));
+    const char *p = list;
+    while (*p) {
+        const char *q = p;
+        while (*q && *q != ',') q++;
+        if (q - p != 2) {
+            fprintf(stderr, "Error: Invalid tag '%.*s' in list '%s'\n", (int) (q - p), p, list);
+            return -1;
+        }
+        if (p[1] == '*') tag_set_add_prefix(t, p[0]);
+        else tag_set_add(t, p);
+        p = *q ? q + 1 : q;
+    }
+    return 0;
+}
+
+/*
+ * Copy aux tags from 'src' to 'dst', only tags in the set (all tags if 'tags' is NULL).
+ * Tags already present in 'dst' are not changed.
+ * Returns the number of tags copied, -1 on error
+ */
+int aux_copy_tags(bam1_t *dst, const bam1_t *src, const tag_set_t *tags) {
+    const uint8_t *p = bam_get_aux(src);
+    const uint8_t *end = p + bam_get_l_aux(src);
+    int count = 0;
+    while (end - p >= 3) {
+        int size = aux_value_size(p + 2, end);
+        if (size < 0) return -1;
+        if ((!tags || tag_set_has(tags, p)) && !bam_aux_get(dst, (const char *) p)) {
+            if (bam_aux_append(dst, (const char *) p, p[2], size, p + 3) < 0) return -1;
+            count++;
+        }
+        p += 3 + size;
+    }
+    return count;
+}
+
+/*
+ * Remove tags in place, in a single scan of the aux block (after a scan checking it).
+ * If 'keep' is set, only tags in the set are kept; otherwise tags in the set are removed.
+ * Returns the number of tags removed, -1 on error (malformed tags: the record is not changed)
+ */
+int aux_filter_tags(bam1_t *b, const tag_set_t *tags, int keep) {
+    uint8_t *aux = bam_get_aux(b);
+    uint8_t *end = aux + bam_get_l_aux(b);
+    uint8_t *src = aux, *dst = aux;
+    while (end - src >= 3) {
+        int size = aux_value_size(src + 2, end);
+        if (size < 0) return -1;
+        src += 3 + size;
+    }
+    if (src != end) return -1;
+
+    int count = 0;
+    for (src = aux; src < end;) {
+        int len = 3 + aux_value_size(src + 2, end);
+        if (tag_set_has(tags, src) == keep) {
+            if (dst != src) memmove(dst, src, len);
+            dst += len;
+        } else {
+            count++;
+        }
+        src += len;
+    }
+    b->l_data -= src - dst;
+    return count;
+}
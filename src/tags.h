@@ -0,0 +1,73 @@
+#ifndef UMI_RX_TAGS_H
+#define UMI_RX_TAGS_H
+
+#include <stdint.h>
+
+#include "htslib/sam.h"
+
+/*
+ * Set of aux tags, as a bitmap indexed by the two tag characters.
+ * Checking whether a tag is in the set is a shift and a mask
+ */
+typedef struct tag_set_t {
+    uint64_t bits[1 << 10];
+    int n;                      // Number of tags in the set
+} tag_set_t;
+
+#define TAG_ID(tag) ((((unsigned) (uint8_t) (tag)[0]) << 8) | (uint8_t) (tag)[1])
+
+static inline int tag_set_has(const tag_set_t *t, const uint8_t *tag) {
+    unsigned id = TAG_ID(tag);
+    return (t->bits[id >> 6] >> (id & 63)) & 1;
+}
+
+static inline void tag_set_add(tag_set_t *t, const char *tag) {
+    unsigned id = TAG_ID(tag);
+    if (!((t->bits[id >> 6] >> (id & 63)) & 1)) t->n++;
+    t->bits[id >> 6] |= 1ULL << (id & 63);
+}
+
+// Add all tags starting with 'c' (i.e. 'c*')
+static inline void tag_set_add_prefix(tag_set_t *t, char c) {
+    char tag[2] = {c, 0};
+    for (int i = 0; i < 256; i++) {
+        tag[1] = (char) i;
+        tag_set_add(t, tag);
+    }
+}
+
+/*
+ * Size of an aux value, 's' points to the type character.
+ * Returns -1 if the value is malformed or goes past 'end'
+ */
+static inline int aux_value_size(const uint8_t *s, const uint8_t *end) {
+    if (s >= end) return -1;
+    int size;
+    switch (*s) {
+    case 'A': case 'c': case 'C': size = 1; break;
+    case 's': case 'S': size = 2; break;
+    case 'i': case 'I': case 'f': size = 4; break;
+    case 'd': size = 8; break;
+    case 'Z': case 'H': {
+        const uint8_t *p = s + 1;
+        while (p < end && *p) p++;
+        return p < end ? (int) (p - s) : -1;
+    }
+    case 'B': {
+        if (end - s < 6) return -1;
+        int esize = aux_value_size(s + 1, end);
+        if (esize <= 0 || esize > 4 || s[1] == 'Z' || s[1] == 'H' || s[1] == 'B') return -1;
+        int64_t n = (int64_t) s[2] | ((int64_t) s[3] << 8) | ((int64_t) s[4] << 16) | ((int64_t) s[5] << 24);
+        int64_t size = 5 + n * esize;
+        return size <= end - s - 1 ? (int) size : -1;
+    }
+    default: return -1;
+    }
+    return size <= end - s - 1 ? size : -1;
+}
+
+int tag_set_parse(tag_set_t *t, const char *list);
+int aux_copy_tags(bam1_t *dst, const bam1_t *src, const tag_set_t *tags);
+int aux_filter_tags(bam1_t *b, const tag_set_t *tags, int keep);
+
+#endif
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+#include "trace.h"
+
+static const char *thread_names[STAGE_N] = {"reader", "tag", "writer"};
+
+// Allocate ring buffers. 'sample': record one loop iteration every 'sample'
+int trace_init(trace_t *t, const char *file, int sample) {
+    memset(t, 0, sizeof(trace_t));
+    if (!file) return 0;
+    for (int i = 0; i < STAGE_N; i++) {
+        t->bufs[i].sample = sample > 0 ? sample : 1;
+        if (!(t->bufs[i].events = malloc(TRACE_RING_SIZE * sizeof(trace_event_t)))) {
+            trace_destroy(t);
+            return -1;
+        }
+        mem_add(MEM_TRACE, TRACE_RING_SIZE * sizeof(trace_event_t));
+    }
+    t->file = file;
+    t->start_ns = stats_now_ns();
+    return 0;
+}
+
+void trace_destroy(trace_t *t) {
+    for (int i = 0; i < STAGE_N; i++) {
+        if (t->bufs[i].events) mem_add(MEM_TRACE, -(int64_t) (TRACE_RING_SIZE * sizeof(trace_event_t)));
+        free(t->bufs[i].events);
+    }
+    memset(t, 0, sizeof(trace_t));
+}
+
+// Write trace event JSON (timestamps in microseconds). Pipeline threads must be joined
+int trace_write(trace_t *t) {
+    if (!t->file) return 0;
+    FILE *fp = fopen(t->file, "w");
+    if (!fp) {
+        fprintf(stderr, "Error writing trace \"%s\"\n", t->file);
+        return -1;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (int i = 0; i < STAGE_N; i++) {
+        fprintf(fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}", i ? ",\n" : "", i, thread_names[i]);
+        trace_buf_t *b = &t->bufs[i];
+        long first = b->n > TRACE_RING_SIZE ? b->n - TRACE_RING_SIZE : 0;
+        for (long j = first; j < b->n; j++) {
+            trace_event_t *ev = &b->events[j % TRACE_RING_SIZE];
+            fprintf(fp, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"records\": %ld}}",
+                    ev->name, i, (ev->start_ns - t->start_ns) / 1e3, ev->dur_ns / 1e3, ev->records);
+        }
+    }
+    fprintf(fp, "\n]}\n");
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error writing trace \"%s\"\n", t->file);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+#ifndef UMI_RX_TRACE_H
+#define UMI_RX_TRACE_H
+
+#include <stdint.h>
+
+#include "stats.h"
+
+#define TRACE_RING_SIZE 65536   // Events kept per thread (the oldest are overwritten)
+
+// One span: 'ph: X' event in Chrome's trace event format
+typedef struct trace_event_t {
+    const char *name;           // Static string
+    int64_t start_ns, dur_ns;
+    long records;
+} trace_event_t;
+
+/*
+ * Per-thread ring buffer: only written by its thread (no locks, no atomics
+ * on the hot path), read after the thread is joined.
+ */
+typedef struct trace_buf_t {
+    trace_event_t *events;
+    long n;                     // Events recorded, the ring has the last TRACE_RING_SIZE
+    long iter;                  // Loop iterations, only one in 'sample' is recorded
+    int sample;
+} __attribute__((aligned(STATS_CACHE_LINE))) trace_buf_t;
+
+/*
+ * Timeline of pipeline stages ('--trace'), one thread per stage (STAGE_*).
+ * Written as Chrome / Perfetto trace event JSON at the end of the run.
+ */
+typedef struct trace_t {
+    const char *file;           // NULL: tracing disabled
+    trace_buf_t bufs[STAGE_N];
+    int64_t start_ns;
+} trace_t;
+
+// Start a loop iteration of 'stage': returns the buffer if it is sampled, NULL otherwise
+static inline trace_buf_t *trace_next(trace_t *t, int stage) {
+    if (!t->file) return NULL;
+    trace_buf_t *b = &t->bufs[stage];
+    return b->iter++ % b->sample == 0 ? b : NULL;
+}
+
+static inline int64_t trace_begin(trace_buf_t *b) {
+    return b ? stats_now_ns() : 0;
+}
+
+static inline void trace_end(trace_buf_t *b, const char *name, int64_t start_ns, long records) {
+    if (!b) return;
+    trace_event_t *ev = &b->events[b->n++ % TRACE_RING_SIZE];
+    ev->name = name;
+    ev->start_ns = start_ns;
+    ev->dur_ns = stats_now_ns() - start_ns;
+    ev->records = records;
+}
+
+int trace_init(trace_t *t, const char *file, int sample);
+int trace_write(trace_t *t);
+void trace_destroy(trace_t *t);
+
+#endif
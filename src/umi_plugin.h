@@ -0,0 +1,49 @@
+#ifndef UMI_PLUGIN_H
+#define UMI_PLUGIN_H
+
+/*
+ * Plugin interface for custom per-record tag computations.
+ *
+ * A plugin is a shared library exporting 'umi_plugin_info', which returns
+ * a pointer to a static 'umi_plugin_t'. Plugins run inside the umi_rx
+ * pipeline, after the built-in tags are added, and receive batches of
+ * records (not single records) so they can amortize per-call work.
+ * All calls are done from the same thread.
+ *
+ * Example (see 'src/plugins/name_field.c'):
+ *
+ *      static const umi_plugin_t plugin = { UMI_PLUGIN_API_VERSION, "my_plugin", 0, my_init, my_process, my_destroy };
+ *      const umi_plugin_t *umi_plugin_info(void) { return &plugin; }
+ *
+ * Usage: umi_rx --plugin ./my_plugin.so:ARGS in.bam out.bam
+ */
+
+#include "htslib/sam.h"
+
+#define UMI_PLUGIN_API_VERSION 1
+
+// Flags
+#define UMI_PLUGIN_NAME_GROUPS 1    // Records with the same read name are never split across batches
+
+#define UMI_PLUGIN_ENTRY "umi_plugin_info"
+
+typedef struct umi_plugin_t {
+    int api_version;        // Must be UMI_PLUGIN_API_VERSION
+    const char *name;
+    int flags;              // UMI_PLUGIN_* flags
+
+    // Called once, before the output header is written (the plugin may add header lines).
+    // 'args' is the text after ':' in the plugin spec (empty string if none).
+    // Returns the plugin state, NULL on error
+    void *(*init)(const char *args, sam_hdr_t *header);
+
+    // Process a batch of records. Returns negative on error
+    int (*process)(void *state, const sam_hdr_t *header, bam1_t **recs, int n);
+
+    // Free plugin state (may be NULL)
+    void (*destroy)(void *state);
+} umi_plugin_t;
+
+typedef const umi_plugin_t *(*umi_plugin_info_f)(void);
+
+#endif
@@ -1,103 +1,198 @@
+#include <getopt.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #include "htslib/sam.h"
 #include "htslib/vcf.h"
 
-#define SHOW_NLINES 10000
-#define SHOW_NLINES_NEWLINE (100*SHOW_NLINES)
+#include "engine.h"
+#include "umi_rx.h"
+
+char *umi_rx_cmdline = NULL;
+
+// Long options without a short option
+enum { OPT_CHECKPOINT_EVERY = 256, OPT_RESUME, OPT_STATS_SOCKET, OPT_METRICS, OPT_METRICS_EVERY, OPT_TRACE, OPT_TRACE_SAMPLE };
+
+static void usage(FILE *fp, const char *prog) {
+    fprintf(fp,
+            "Usage: %s [options] input.bam output.bam\n"
+            "       %s fastq [options] R1.fastq.gz R2.fastq.gz output.bam\n"
+            "       %s join [options] input.bam umi.fastq.gz output.bam\n"
+            "       %s zipper [options] unaligned.bam aligned.bam output.bam\n"
+            "\n"
+            "Add UMIs from read names to 'RX' tags.\n"
+            "Mate tags / fix mate options require the input to be grouped by read name.\n"
+            "\n"
+            "Options:\n"
+            "  -c, --mc            Add MC tag (mate cigar)\n"
+            "  -q, --mq            Add MQ tag (mate mapping quality)\n"
+            "  -m, --ms            Add ms tag (mate score, as 'samtools fixmate -m')\n"
+            "  -f, --fixmate       Fix mate reference, position, flags and template length (as 'samtools fixmate')\n"
+            "  -R, --remove-tags LIST  Remove tags (comma separated, 'X*' for all tags starting with 'X')\n"
+            "  -K, --keep-tags LIST    Remove all tags except these ones ('RX' is always added)\n"
+            "  -b, --qual-bin SPEC     Bin base qualities: 'illumina' (8 levels) or 'lower_bound:value,...'\n"
+            "  -F, --exclude-flags FLAGS  Drop records with any of these flags (e.g. 'SECONDARY,QCFAIL' or 0x300)\n"
+            "  -Q, --min-mapq INT      Drop records with lower mapping quality\n"
+            "  -e, --filter EXPR       Drop records not matching this htslib filter expression\n"
+            "  -p, --plugin SO[:ARGS]  Load a tag plugin (shared library), can be used multiple times\n"
+            "  -E, --on-error POLICY   Malformed records (e.g. no UMI in the read name): 'abort' (default), 'skip',\n"
+            "                          'pass' (keep without RX tag) or 'reject:FILE' (write them to a BAM file)\n"
+            "  -g, --max-group INT Maximum records with the same read name (mate tags, grouped plugins). Default: %d\n"
+            "  -l, --level INT     Compression level for output BAM\n"
+            "  -@, --threads INT   Number of threads for (de)compression. Default: 0\n"
+            "  -C, --checkpoint FILE   Save progress to FILE periodically (BAM input and output files only)\n"
+            "      --checkpoint-every SEC  Seconds between checkpoints. Default: %d\n"
+            "      --resume            Truncate the output to the last checkpoint and continue from there\n"
+            "      --stats-socket PATH Serve live stats (JSON) on a Unix socket. Stats are also shown on SIGUSR1\n"
+            "      --metrics FILE      Write Prometheus metrics to FILE periodically (node exporter textfile collector)\n"
+            "      --metrics-every SEC Seconds between metrics files. Default: %d\n"
+            "      --trace FILE        Write a timeline of pipeline stages (Chrome / Perfetto trace event JSON)\n"
+            "      --trace-sample N    Trace one batch every N per stage. Default: 1\n", prog, prog, prog, prog, ENGINE_MAX_GROUP, ENGINE_CHECKPOINT_EVERY, STATS_METRICS_EVERY);
+}
 
-int main(int argc, char **argv) {
-    if(argc != 3) {
-        fprintf(stderr, "Usage: %s input.bam output.bam\n", argv[0]);
-        return 1;
+// Join all command line arguments
+static char *join_args(int argc, char **argv) {
+    kstring_t str = KS_INITIALIZE;
+    for (int i = 0; i < argc; i++) {
+        if (i > 0) kputc(' ', &str);
+        kputs(argv[i], &str);
     }
+    return ks_release(&str);
+}
 
-    char moder[8];
-    char *filein = argv[1];
-    char *fileout = argv[2];
-
-    // Open in.bam
-    htsFile *in = hts_open(filein, "r");
-    if (!in) {
-        fprintf(stderr, "Error opening \"%s\"\n", filein);
-        exit(1);
+int main(int argc, char **argv) {
+    umi_rx_cmdline = join_args(argc, argv);
+
+    // Sub-commands
+    if (argc > 1 && strcmp(argv[1], "fastq") == 0) return main_fastq(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "join") == 0) return main_join(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "zipper") == 0) return main_zipper(argc - 1, argv + 1);
+
+    static const struct option lopts[] = {
+        {"mc", no_argument, NULL, 'c'},
+        {"mq", no_argument, NULL, 'q'},
+        {"ms", no_argument, NULL, 'm'},
+        {"fixmate", no_argument, NULL, 'f'},
+        {"remove-tags", required_argument, NULL, 'R'},
+        {"keep-tags", required_argument, NULL, 'K'},
+        {"qual-bin", required_argument, NULL, 'b'},
+        {"exclude-flags", required_argument, NULL, 'F'},
+        {"min-mapq", required_argument, NULL, 'Q'},
+        {"filter", required_argument, NULL, 'e'},
+        {"plugin", required_argument, NULL, 'p'},
+        {"on-error", required_argument, NULL, 'E'},
+        {"max-group", required_argument, NULL, 'g'},
+        {"level", required_argument, NULL, 'l'},
+        {"threads", required_argument, NULL, '@'},
+        {"checkpoint", required_argument, NULL, 'C'},
+        {"checkpoint-every", required_argument, NULL, OPT_CHECKPOINT_EVERY},
+        {"resume", no_argument, NULL, OPT_RESUME},
+        {"stats-socket", required_argument, NULL, OPT_STATS_SOCKET},
+        {"metrics", required_argument, NULL, OPT_METRICS},
+        {"metrics-every", required_argument, NULL, OPT_METRICS_EVERY},
+        {"trace", required_argument, NULL, OPT_TRACE},
+        {"trace-sample", required_argument, NULL, OPT_TRACE_SAMPLE},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    static engine_t engine;
+    engine_init(&engine);
+    engine.stats_signal = 1;
+    tagger_t *opts = &engine.tagger;
+    mate_tags_t *mate = &opts->mate;
+    char *exclude_flags = NULL, *filter_expr = NULL, *tags = NULL, *qual_bin = NULL, *on_error = "abort";
+    char **plugins = calloc(argc, sizeof(char *));
+    int min_mapq = 0, level = -1, threads = 0, n_plugins = 0, c;
+    while ((c = getopt_long(argc, argv, "cqmfR:K:b:F:Q:e:p:E:g:l:@:C:h", lopts, NULL)) >= 0) {
+        switch (c) {
+        case 'c': mate->calc_mc = 1; break;
+        case 'q': mate->calc_mq = 1; break;
+        case 'm': mate->calc_ms = 1; break;
+        case 'f': mate->fixmate = 1; break;
+        case 'R':
+        case 'K':
+            if (opts->filter_tags != FILTER_TAGS_NONE) {
+                fprintf(stderr, "Error: Only one of '--remove-tags' or '--keep-tags' can be used\n");
+                return 1;
+            }
+            if (tag_set_parse(&opts->tags, optarg) < 0) return 1;
+            tags = optarg;
+            opts->filter_tags = c == 'R' ? FILTER_TAGS_REMOVE : FILTER_TAGS_KEEP;
+            break;
+        case 'b':
+            if (qual_bin_init(&opts->qual_bin, optarg) < 0) return 1;
+            qual_bin = optarg;
+            opts->bin_quals = 1;
+            break;
+        case 'F': exclude_flags = optarg; break;
+        case 'Q': min_mapq = atoi(optarg); break;
+        case 'e': filter_expr = optarg; break;
+        case 'p': plugins[n_plugins++] = optarg; break;
+        case 'E':
+            if (tagger_on_error(opts, optarg, &engine.reject_file) < 0) return 1;
+            on_error = optarg;
+            break;
+        case 'l': level = atoi(optarg); break;
+        case '@': threads = atoi(optarg); break;
+        case 'g': engine.max_group = atoi(optarg); break;
+        case 'C': engine.checkpoint = optarg; break;
+        case OPT_CHECKPOINT_EVERY: engine.checkpoint_every = atoi(optarg); break;
+        case OPT_RESUME: engine.resume = 1; break;
+        case OPT_STATS_SOCKET: engine.stats_socket = optarg; break;
+        case OPT_METRICS: engine.metrics_file = optarg; break;
+        case OPT_METRICS_EVERY: engine.metrics_every = atoi(optarg); break;
+        case OPT_TRACE: engine.trace_file = optarg; break;
+        case OPT_TRACE_SAMPLE: engine.trace_sample = atoi(optarg); break;
+        case 'h': usage(stdout, argv[0]); return 0;
+        default: usage(stderr, argv[0]); return 1;
+        }
     }
-
-    // Open out.bam
-    htsFile *out = hts_open(fileout, "wb");
-    if (!out) {
-        fprintf(stderr, "Error opening \"%s\"\n", filein);
-        exit(1);
+    if (argc - optind != 2) {
+        usage(stderr, argv[0]);
+        return 1;
     }
 
-    // Read header
-    sam_hdr_t *header = sam_hdr_read(in);
-    if (header == NULL) {
-        fprintf(stderr, "Couldn't read header for \"%s\"\n", filein);
-        exit(1);
+    if (engine.max_group <= 0) {
+        fprintf(stderr, "Error: '--max-group' must be positive\n");
+        return 1;
     }
 
-    // Write header
-    if (sam_hdr_write(out, header) < 0) {
-        fprintf(stderr, "Error writing output header.\n");
-        exit(1);
+    if (engine.resume && !engine.checkpoint) {
+        fprintf(stderr, "Error: '--resume' requires '--checkpoint'\n");
+        return 1;
     }
 
-    bam1_t *aln = bam_init1();
-    long read_num;
-    for (read_num = 1; sam_read1(in, header, aln) > 0; read_num++) {
-        char *read_name = bam_get_qname(aln);
-        int32_t pos = aln->core.pos + 1;
-        char *chr = header->target_name[aln->core.tid];
-
-        // Find UMI part
-        char *umi = strrchr(read_name, ':');
-        if (!umi) {
-            fprintf(stderr, "Error: Could not find UMI from read name, read_number=%ld, chr='%s', pos=%d, read_name='%s'\n", read_num, chr, pos, read_name);
-            exit(1);
-        }
-        umi++; // We want the string starting right after ':'
-
-        // UMI length
-        long umilen = strlen(umi) + 1;
-
-        // Show every N reads
-        if( read_num % SHOW_NLINES == 0 ) {
-            putchar('.');
-            if( read_num % SHOW_NLINES_NEWLINE == 0 )   printf("\n%ld reads\t", read_num);
-            fflush(stdout);
-        }
+    char *filein = argv[optind];
+    char *fileout = argv[optind + 1];
 
-        // Add UMI to 'RX' tag
-        if (bam_aux_append(aln, "RX", 'Z', umilen, (uint8_t *) umi) < 0) {
-            fprintf(stderr, "Error updating RX tag");
-            exit(1);
-        }
+    // Filters are compiled once
+    if (read_filter_init(&opts->filter, exclude_flags, min_mapq, filter_expr) < 0) return 1;
 
-        // Write alignment to output
-        if (sam_write1(out, header, aln) < 0) {
-            fprintf(stderr, "Error writing output alignment, read_number=%ld, chr='%s', pos=%d, read_name='%s'\n", read_num, chr, pos, read_name);
-            exit(1);
-        }
-    }
+    // Output mode
+    char modew[8] = "wb";
+    if (level >= 0) snprintf(modew, sizeof(modew), "wb%d", level > 9 ? 9 : level);
 
-    printf("\nFinished: %ld reads processed\n", read_num);
+    // Options changing the output, in a fixed order: checkpoints are only resumed with the same ones
+    kstring_t options = KS_INITIALIZE;
+    ksprintf(&options, "mc=%d mq=%d ms=%d fixmate=%d %s=%s qual_bin=%s exclude_flags=%s min_mapq=%d filter=%s on_error=%s max_group=%d",
+             mate->calc_mc, mate->calc_mq, mate->calc_ms, mate->fixmate, opts->filter_tags == FILTER_TAGS_KEEP ? "keep_tags" : "remove_tags", tags ? tags : "",
+             qual_bin ? qual_bin : "", exclude_flags ? exclude_flags : "", min_mapq, filter_expr ? filter_expr : "", on_error, engine.max_group);
+    for (int i = 0; i < n_plugins; i++) ksprintf(&options, " plugin=%s", plugins[i]);
+    engine.options = ks_str(&options);
 
-    // Close files
-    if (hts_close(out) < 0) {
-        fprintf(stderr, "Error closing \"%s\"\n", fileout);
-        exit(1);
-    }
+    int ret = engine_run_files(&engine, filein, fileout, modew, threads, plugins, n_plugins);
+    free(plugins);
+    if (ret < 0) exit(1);
 
-    if (hts_close(in) < 0) {
-        fprintf(stderr, "Error closing \"%s\"\n", filein);
-        exit(1);
-    }
+    fprintf(stderr, "\nFinished: %ld reads processed\tcountMc: %ld\tcountMq: %ld\tcountMs: %ld\tcountFixmate: %ld\tcountRemovedTags: %ld\tcountFiltered: %ld\terrorsNoUmi: %ld\terrorsBadTags: %ld\n", engine.read_num, mate->count_mc, mate->count_mq, mate->count_ms, mate->count_fixmate, opts->count_removed, opts->filter.count_filtered, opts->count_errors[ERROR_NO_UMI], opts->count_errors[ERROR_BAD_TAGS]);
+    mem_report(stderr);
 
     // Free memory
-    bam_destroy1(aln);
-    sam_hdr_destroy(header);
+    engine_destroy(&engine);
+    ks_free(&options);
+    free(umi_rx_cmdline);
 
     return 0;
 }
@@ -0,0 +1,40 @@
+#ifndef UMI_RX_H
+#define UMI_RX_H
+
+#include <stdio.h>
+#include <string.h>
+
+#define UMI_RX_VERSION "0.2"
+
+#define SHOW_NLINES 10000
+#define SHOW_NLINES_NEWLINE (100*SHOW_NLINES)
+
+extern char *umi_rx_cmdline;    // Full command line, used in '@PG' header lines
+
+// Sub-commands
+int main_fastq(int argc, char **argv);
+int main_join(int argc, char **argv);
+int main_zipper(int argc, char **argv);
+
+/*
+ * Find UMI in a read name: UMI is the last entry in the read name (when splitting by ':')
+ * Example:
+ *      Read name: A00324:79:HJ5CMDSXX:2:1101:19705:1172:CGCACG
+ *      UMI      : CGCACG
+ * Returns NULL if there is no ':' in the read name
+ */
+static inline char *umi_from_name(char *read_name) {
+    char *umi = strrchr(read_name, ':');
+    return umi ? umi + 1 : NULL;
+}
+
+// Show every N reads
+static inline void show_progress(long read_num) {
+    if( read_num % SHOW_NLINES == 0 ) {
+        fputc('.', stderr);
+        if( read_num % SHOW_NLINES_NEWLINE == 0 )   fprintf(stderr, "\n%ld reads\t", read_num);
+        fflush(stderr);
+    }
+}
+
+#endif
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tagger.h"
+#include "umirx.h"
+
+#define UMIRX_CHUNK 1024    // Minimum records per thread pool job
+
+// Tag a chunk of records on a thread pool worker
+typedef struct umirx_job_t {
+    tagger_t tagger;        // Clone: own buffers and counters
+    const sam_hdr_t *header;
+    bam1_t **recs;
+    int n;
+    const long *read_nums;  // Input record numbers
+    int ret;
+} umirx_job_t;
+
+struct umirx_t {
+    tagger_t tagger;
+    const sam_hdr_t *header;
+    long records;
+    long *read_nums;        // Input record numbers of the records kept by filters
+    int m_read_nums;
+    hts_tpool *pool;
+    hts_tpool_process *q;
+    umirx_job_t *jobs;
+    int njobs;
+};
+
+int umirx_api_version(void) {
+    return UMIRX_API_VERSION;
+}
+
+void umirx_opts_init(umirx_opts_t *opts) {
+    memset(opts, 0, sizeof(umirx_opts_t));
+}
+
+umirx_t *umirx_init(const umirx_opts_t *opts, const sam_hdr_t *header) {
+    if (opts->remove_tags && opts->keep_tags) {
+        fprintf(stderr, "Error: Only one of 'remove_tags' or 'keep_tags' can be used\n");
+        return NULL;
+    }
+
+    umirx_t *u = calloc(1, sizeof(umirx_t));
+    if (!u) return NULL;
+    tagger_t *t = &u->tagger;
+    tagger_init(t);
+    u->header = header;
+
+    mate_tags_init(&t->mate, (opts->flags & UMIRX_MC) != 0, (opts->flags & UMIRX_MQ) != 0);
+    t->mate.calc_ms = (opts->flags & UMIRX_MS) != 0;
+    t->mate.fixmate = (opts->flags & UMIRX_FIXMATE) != 0;
+
+    const char *tags = opts->remove_tags ? opts->remove_tags : opts->keep_tags;
+    if (tags) {
+        if (tag_set_parse(&t->tags, tags) < 0) goto error;
+        t->filter_tags = opts->remove_tags ? FILTER_TAGS_REMOVE : FILTER_TAGS_KEEP;
+    }
+    if (opts->qual_bin) {
+        if (qual_bin_init(&t->qual_bin, opts->qual_bin) < 0) goto error;
+        t->bin_quals = 1;
+    }
+    if (read_filter_init(&t->filter, opts->exclude_flags, opts->min_mapq, opts->filter) < 0) goto error;
+    tagger_prepare(t);
+
+    return u;
+
+error:
+    umirx_destroy(u);
+    return NULL;
+}
+
+int umirx_set_thread_pool(umirx_t *u, htsThreadPool *tp) {
+    if (u->q) hts_tpool_process_destroy(u->q);
+    u->q = NULL;
+    u->pool = NULL;
+    if (!tp || !tp->pool) return 0;
+
+    // Input only queue: jobs write their results in place
+    int nthreads = hts_tpool_size(tp->pool);
+    if (!(u->q = hts_tpool_process_init(tp->pool, 2 * nthreads, 1))) {
+        fprintf(stderr, "Error creating thread pool queue\n");
+        return -1;
+    }
+    u->pool = tp->pool;
+    return 0;
+}
+
+static void *umirx_job(void *arg) {
+    umirx_job_t *job = (umirx_job_t *) arg;
+    job->ret = tagger_tag(&job->tagger, job->header, job->recs, job->n, job->read_nums);
+    return NULL;
+}
+
+// Make sure there are at least 'n' jobs
+static int umirx_jobs_grow(umirx_t *u, int n) {
+    if (n <= u->njobs) return 0;
+    umirx_job_t *jobs = realloc(u->jobs, n * sizeof(umirx_job_t));
+    if (!jobs) return -1;
+    u->jobs = jobs;
+    for (; u->njobs < n; u->njobs++) tagger_clone(&u->jobs[u->njobs].tagger, &u->tagger);
+    return 0;
+}
+
+// Split the batch into chunks (never splitting a read name group) and tag them on the thread pool
+static int umirx_tag_parallel(umirx_t *u, bam1_t **recs, int n) {
+    int nchunks = n / UMIRX_CHUNK;
+    int max_chunks = 4 * hts_tpool_size(u->pool);
+    if (nchunks > max_chunks) nchunks = max_chunks;
+    if (umirx_jobs_grow(u, nchunks) < 0) return -1;
+    int chunk = (n + nchunks - 1) / nchunks;
+    int grouped = tagger_grouped(&u->tagger);
+
+    int njobs = 0;
+    for (int start = 0, end; start < n; start = end) {
+        end = start + chunk < n ? start + chunk : n;
+        while (grouped && end < n && strcmp(bam_get_qname(recs[end]), bam_get_qname(recs[end - 1])) == 0) end++;
+
+        // Name groups can make the last chunks bigger: the last job takes the rest
+        if (njobs == nchunks - 1) end = n;
+
+        umirx_job_t *job = &u->jobs[njobs++];
+        job->header = u->header;
+        job->recs = recs + start;
+        job->n = end - start;
+        job->read_nums = u->read_nums + start;
+        job->ret = 0;
+        if (hts_tpool_dispatch(u->pool, u->q, umirx_job, job) < 0) {
+            hts_tpool_process_flush(u->q);
+            return -1;
+        }
+    }
+    if (hts_tpool_process_flush(u->q) < 0) return -1;
+
+    int ret = 0;
+    for (int i = 0; i < njobs; i++) {
+        if (u->jobs[i].ret < 0) ret = -1;
+        tagger_merge_counts(&u->tagger, &u->jobs[i].tagger);
+    }
+    return ret;
+}
+
+int umirx_process(umirx_t *u, bam1_t **recs, int n) {
+    if (n > u->m_read_nums) {
+        long *read_nums = realloc(u->read_nums, n * sizeof(long));
+        if (!read_nums) return -1;
+        u->read_nums = read_nums;
+        u->m_read_nums = n;
+    }
+
+    // Filters are evaluated on the calling thread (filter expressions are not shared)
+    int kept = tagger_filter(&u->tagger, u->header, recs, n, u->records + 1, u->read_nums);
+    if (kept < 0) return -1;
+
+    int ret;
+    if (u->pool && kept >= 2 * UMIRX_CHUNK) ret = umirx_tag_parallel(u, recs, kept);
+    else ret = tagger_tag(&u->tagger, u->header, recs, kept, u->read_nums);
+    u->records += n;
+    return ret < 0 ? -1 : kept;
+}
+
+void umirx_get_stats(const umirx_t *u, umirx_stats_t *stats) {
+    const tagger_t *t = &u->tagger;
+    stats->records = u->records;
+    stats->filtered = t->filter.count_filtered;
+    stats->removed_tags = t->count_removed;
+    stats->mc = t->mate.count_mc;
+    stats->mq = t->mate.count_mq;
+    stats->ms = t->mate.count_ms;
+    stats->fixmate = t->mate.count_fixmate;
+}
+
+void umirx_destroy(umirx_t *u) {
+    if (!u) return;
+    if (u->q) hts_tpool_process_destroy(u->q);
+    for (int i = 0; i < u->njobs; i++) tagger_destroy(&u->jobs[i].tagger);
+    free(u->jobs);
+    free(u->read_nums);
+    tagger_destroy(&u->tagger);
+    free(u);
+}
@@ -0,0 +1,90 @@
+#ifndef UMIRX_H
+#define UMIRX_H
+
+/*
+ * libumirx: add 'RX' (UMI from read name), mate tags and fix mate information
+ * to records in memory, without an extra BAM encode / decode through a pipe.
+ *
+ * Example:
+ *
+ *      umirx_opts_t opts;
+ *      umirx_opts_init(&opts);
+ *      opts.flags = UMIRX_MC | UMIRX_MQ;
+ *      umirx_t *u = umirx_init(&opts, header);
+ *      umirx_set_thread_pool(u, &tp);              // Optional
+ *      while (...) {
+ *          int n = umirx_process(u, recs, nrecs);  // Filtered records are moved to the end
+ *          for (int i = 0; i < n; i++) sam_write1(out, header, recs[i]);
+ *      }
+ *      umirx_destroy(u);
+ *
+ * Link with '-lumirx -lhts'. This header is the only stable interface, 'umirx_t' is opaque.
+ */
+
+#include "htslib/sam.h"
+#include "htslib/thread_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UMIRX_API_VERSION 1
+
+#if defined(__GNUC__)
+#define UMIRX_EXPORT __attribute__((visibility("default")))
+#else
+#define UMIRX_EXPORT
+#endif
+
+// Flags: tags to add (RX is always added)
+#define UMIRX_MC 0x1            // Mate cigar
+#define UMIRX_MQ 0x2            // Mate mapping quality
+#define UMIRX_MS 0x4            // Mate score ('ms', as 'samtools fixmate -m')
+#define UMIRX_FIXMATE 0x8       // Fix mate reference, position, flags and template length
+
+typedef struct umirx_opts_t {
+    int flags;                  // UMIRX_* flags
+    const char *remove_tags;    // Tags to remove (comma separated, 'X*' prefixes), NULL for none
+    const char *keep_tags;      // Remove all tags except these ones, NULL for none
+    const char *qual_bin;       // Quality binning: 'illumina' or 'lower_bound:value,...', NULL for none
+    const char *exclude_flags;  // Drop records with any of these flags, NULL for none
+    int min_mapq;               // Drop records with lower mapping quality
+    const char *filter;         // Drop records not matching this htslib filter expression, NULL for none
+} umirx_opts_t;
+
+typedef struct umirx_stats_t {
+    long records;               // Records processed (including filtered)
+    long filtered;              // Records dropped by filters
+    long removed_tags;          // Tags removed
+    long mc, mq, ms;            // Tags added
+    long fixmate;               // Pairs fixed
+} umirx_stats_t;
+
+typedef struct umirx_t umirx_t;
+
+UMIRX_EXPORT int umirx_api_version(void);
+UMIRX_EXPORT void umirx_opts_init(umirx_opts_t *opts);
+
+// Create a tagger for records using 'header'. Returns NULL on error (a message is shown on stderr)
+UMIRX_EXPORT umirx_t *umirx_init(const umirx_opts_t *opts, const sam_hdr_t *header);
+
+// Tag large batches using an htslib thread pool (NULL to disable). The pool is not owned by 'u'
+UMIRX_EXPORT int umirx_set_thread_pool(umirx_t *u, htsThreadPool *tp);
+
+/*
+ * Process a batch of records in place. Records passing the filters are moved to the
+ * beginning of 'recs' (in the same order), dropped ones are left at the end.
+ * When mate tags or mate fixes are enabled, all records with the same read name
+ * must be in the same batch and next to each other.
+ * Returns the number of records kept, -1 on error
+ */
+UMIRX_EXPORT int umirx_process(umirx_t *u, bam1_t **recs, int n);
+
+UMIRX_EXPORT void umirx_get_stats(const umirx_t *u, umirx_stats_t *stats);
+UMIRX_EXPORT void umirx_destroy(umirx_t *u);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,197 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "htslib/sam.h"
+#include "htslib/thread_pool.h"
+
+#include "group.h"
+#include "mate.h"
+#include "mem.h"
+#include "tags.h"
+#include "umi_rx.h"
+
+#define READ_NUM_FLAGS (BAM_FREAD1 | BAM_FREAD2)
+
+static void usage_zipper(FILE *fp) {
+    fprintf(fp,
+            "Usage: umi_rx zipper [options] unaligned.bam aligned.bam output.bam\n"
+            "\n"
+            "Copy tags from unaligned records (e.g. RX, QX, OX, CB) to the aligned records\n"
+            "with the same read name. Both inputs must be in the same query name grouped order\n"
+            "(e.g. aligner output order). Tags already present in aligned records are kept.\n"
+            "\n"
+            "Options:\n"
+            "  -t, --tags LIST     Comma separated list of tags to copy. Default: all tags\n"
+            "  -c, --mc            Add MC tag (mate cigar)\n"
+            "  -q, --mq            Add MQ tag (mate mapping quality)\n"
+            "  -m, --ms            Add ms tag (mate score, as 'samtools fixmate -m')\n"
+            "  -f, --fixmate       Fix mate reference, position, flags and template length\n"
+            "  -l, --level INT     Compression level for output BAM\n"
+            "  -@, --threads INT   Number of threads for (de)compression. Default: 0\n");
+}
+
+// Find the unaligned record for an aligned one: same first / second of pair flags
+static bam1_t *find_unaligned(bam_group_t *gu, bam1_t *aln) {
+    for (int i = 0; i < gu->n; i++)
+        if ((gu->recs[i]->core.flag & READ_NUM_FLAGS) == (aln->core.flag & READ_NUM_FLAGS)) return gu->recs[i];
+    return gu->n == 1 ? gu->recs[0] : NULL;
+}
+
+// Open a BAM file, read its header
+static htsFile *open_bam(const char *fn, htsThreadPool *tp, sam_hdr_t **header) {
+    htsFile *fp = hts_open(fn, "r");
+    if (!fp) {
+        fprintf(stderr, "Error opening \"%s\"\n", fn);
+        exit(1);
+    }
+    if (tp->pool) hts_set_thread_pool(fp, tp);
+    if (!(*header = sam_hdr_read(fp))) {
+        fprintf(stderr, "Couldn't read header for \"%s\"\n", fn);
+        exit(1);
+    }
+    return fp;
+}
+
+int main_zipper(int argc, char **argv) {
+    static const struct option lopts[] = {
+        {"tags", required_argument, NULL, 't'},
+        {"mc", no_argument, NULL, 'c'},
+        {"mq", no_argument, NULL, 'q'},
+        {"ms", no_argument, NULL, 'm'},
+        {"fixmate", no_argument, NULL, 'f'},
+        {"level", required_argument, NULL, 'l'},
+        {"threads", required_argument, NULL, '@'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    tag_set_t tags;
+    mate_tags_t mate;
+    mate_tags_init(&mate, 0, 0);
+    int use_tags = 0, level = -1, threads = 0, c;
+    while ((c = getopt_long(argc, argv, "t:cqmfl:@:h", lopts, NULL)) >= 0) {
+        switch (c) {
+        case 't':
+            if (tag_set_parse(&tags, optarg) < 0) return 1;
+            use_tags = 1;
+            break;
+        case 'c': mate.calc_mc = 1; break;
+        case 'q': mate.calc_mq = 1; break;
+        case 'm': mate.calc_ms = 1; break;
+        case 'f': mate.fixmate = 1; break;
+        case 'l': level = atoi(optarg); break;
+        case '@': threads = atoi(optarg); break;
+        case 'h': usage_zipper(stdout); return 0;
+        default: usage_zipper(stderr); return 1;
+        }
+    }
+    if (argc - optind != 3) {
+        usage_zipper(stderr);
+        return 1;
+    }
+
+    char *fileunaln = argv[optind], *filealn = argv[optind + 1], *fileout = argv[optind + 2];
+
+    // Thread pool shared by both inputs and the output
+    htsThreadPool tp = {NULL, 0};
+    if (threads > 0 && !(tp.pool = hts_tpool_init(threads))) {
+        fprintf(stderr, "Error creating thread pool\n");
+        exit(1);
+    }
+
+    // Open inputs
+    sam_hdr_t *header_unaln, *header;
+    htsFile *unaln = open_bam(fileunaln, &tp, &header_unaln);
+    htsFile *aln = open_bam(filealn, &tp, &header);
+
+    // Open out.bam
+    char modew[8] = "wb";
+    if (level >= 0) snprintf(modew, sizeof(modew), "wb%d", level > 9 ? 9 : level);
+    htsFile *out = hts_open(fileout, modew);
+    if (!out) {
+        fprintf(stderr, "Error opening \"%s\"\n", fileout);
+        exit(1);
+    }
+    if (tp.pool) hts_set_thread_pool(out, &tp);
+
+    // Write header: aligned BAM header plus '@PG' line
+    sam_hdr_add_pg(header, "umi_rx", "VN", UMI_RX_VERSION, "CL", umi_rx_cmdline, NULL);
+    if (sam_hdr_write(out, header) < 0) {
+        fprintf(stderr, "Error writing output header.\n");
+        exit(1);
+    }
+
+    group_reader_t ru, ra;
+    group_reader_init(&ru, unaln, header_unaln);
+    group_reader_init(&ra, aln, header);
+    bam_group_t gu, ga;
+    group_init(&gu);
+    group_init(&ga);
+
+    long read_num = 0, count_tags = 0;
+    int na;
+    while ((na = group_read(&ra, &ga)) > 0) {
+        // Unaligned reads for this group
+        if (group_read(&ru, &gu) <= 0 || strcmp(bam_get_qname(gu.recs[0]), bam_get_qname(ga.recs[0])) != 0) {
+            fprintf(stderr, "Error: Could not find unaligned read, inputs must be in the same query name order, read_number=%ld, read_name='%s'\n", ra.read_num, bam_get_qname(ga.recs[0]));
+            exit(1);
+        }
+
+        // Copy tags from unaligned reads
+        for (int i = 0; i < na; i++) {
+            bam1_t *src = find_unaligned(&gu, ga.recs[i]);
+            int ret = src ? aux_copy_tags(ga.recs[i], src, use_tags ? &tags : NULL) : 0;
+            if (ret < 0) {
+                fprintf(stderr, "Error copying tags, read_name='%s'\n", bam_get_qname(ga.recs[0]));
+                exit(1);
+            }
+            count_tags += ret;
+        }
+
+        // Add mate tags
+        if (mate_tags_group(&mate, ga.recs, na) < 0) {
+            fprintf(stderr, "Error adding mate tags, read_name='%s'\n", bam_get_qname(ga.recs[0]));
+            exit(1);
+        }
+
+        // Write alignments to output
+        for (int i = 0; i < na; i++) {
+            if (sam_write1(out, header, ga.recs[i]) < 0) {
+                fprintf(stderr, "Error writing output alignment, read_name='%s'\n", bam_get_qname(ga.recs[0]));
+                exit(1);
+            }
+            show_progress(++read_num);
+        }
+    }
+    if (na < 0 || group_read(&ru, &gu) != 0) {
+        fprintf(stderr, "Error: %s\n", na < 0 ? "Failed reading aligned BAM" : "Unaligned BAM has reads not present in aligned BAM");
+        exit(1);
+    }
+
+    fprintf(stderr, "\nFinished: %ld reads processed\tcountTags: %ld\tcountMc: %ld\tcountMq: %ld\tcountMs: %ld\tcountFixmate: %ld\n", read_num, count_tags, mate.count_mc, mate.count_mq, mate.count_ms, mate.count_fixmate);
+    mem_report(stderr);
+
+    // Close files
+    if (hts_close(out) < 0) {
+        fprintf(stderr, "Error closing \"%s\"\n", fileout);
+        exit(1);
+    }
+    if (hts_close(aln) < 0 || hts_close(unaln) < 0) {
+        fprintf(stderr, "Error closing input files\n");
+        exit(1);
+    }
+
+    // Free memory
+    mate_tags_destroy(&mate);
+    group_destroy(&ga);
+    group_destroy(&gu);
+    group_reader_destroy(&ra);
+    group_reader_destroy(&ru);
+    sam_hdr_destroy(header);
+    sam_hdr_destroy(header_unaln);
+    if (tp.pool) hts_tpool_destroy(tp.pool);
+
+    return 0;
+}